@@ -15,6 +15,12 @@ protected:
 	int BalanceFactor(BinNode<T>* pos) { return stature(pos->lChild) - stature(pos->rChild); }
 	bool AVLBalanced(BinNode<T>* pos) { return BalanceFactor(pos) > -2 && BalanceFactor(pos) < 2; }
 	BinNode<T>* tallerChild(BinNode<T>* pos);
+
+	virtual BinNode<T>* joinNodes(BinNode<T>* l, BinNode<T>* k, BinNode<T>* r) override;
+	using BinarySearchTree<T>::joinNodes;
+
+	// Rebalance from node up to the root after a subtree grows or shrinks, return the root
+	BinNode<T>* rebalanceAbove(BinNode<T>* node);
 };
 
 template<typename T>
@@ -38,28 +44,80 @@ inline BinNode<T>* AVLTree<T>::tallerChild(BinNode<T>* pos)
 	}
 }
 
+template<typename T>
+BinNode<T>* AVLTree<T>::joinNodes(BinNode<T>* l, BinNode<T>* k, BinNode<T>* r)
+{
+	const int lHeight = stature(l);
+	const int rHeight = stature(r);
+	if (lHeight <= rHeight + 1 && rHeight <= lHeight + 1) return BinarySearchTree<T>::joinNodes(l, k, r);
+
+	if (lHeight > rHeight)
+	{
+		// Go down the right side of l to a subtree not taller than r + 1, k takes its place with it and r.
+		// The subtree grows 1 at most, like an insert.
+		BinNode<T>* p = l;
+		while (stature(p->rChild) > rHeight + 1) p = p->rChild;
+		BinNode<T>* c = p->rChild;
+		if (c) c->parent = nullptr;
+		p->rChild = nullptr;
+		p->insertAsRChild(BinarySearchTree<T>::joinNodes(c, k, r));
+		return rebalanceAbove(p);
+	}
+	else
+	{
+		BinNode<T>* p = r;
+		while (stature(p->lChild) > lHeight + 1) p = p->lChild;
+		BinNode<T>* c = p->lChild;
+		if (c) c->parent = nullptr;
+		p->lChild = nullptr;
+		p->insertAsLChild(BinarySearchTree<T>::joinNodes(l, k, c));
+		return rebalanceAbove(p);
+	}
+}
+
+template<typename T>
+BinNode<T>* AVLTree<T>::rebalanceAbove(BinNode<T>* node)
+{
+	// Like erase, more than one rotation may be needed
+	BinNode<T>* root = node;
+	for (BinNode<T>* g = node; g; g = g->parent)
+	{
+		if (!AVLBalanced(g))
+		{
+			g = this->rotateAt(tallerChild(tallerChild(g)));
+		}
+		this->updateHeight(g);
+		root = g;
+	}
+	return root;
+}
+
 template<typename T>
 BinNode<T>* AVLTree<T>::insert(const T & val)
 {
 	if (this->empty())
 	{
 		this->insertAsRoot(val);
+		this->addToSearchFilter(val);
 		return this->root();
 	}
 
-	BinNode<T>* pos = this->search(val);
+	BinNode<T>* pos = this->searchIn(this->_root, val);
 	BinNode<T>* ret = nullptr;
 	if (!pos)
 	{
 		if (val > this->_hot->getData())
 		{
-			ret = this->_hot->insertAsRChild(new BinNode<T>(val));
+			ret = this->_hot->insertAsRChild(this->createNode(val));
 		}
 		else
 		{
-			ret = this->_hot->insertAsLChild(new BinNode<T>(val));
+			ret = this->_hot->insertAsLChild(this->createNode(val));
 		}
+		this->threadInserted(ret);
 		++(this->_size);
+		this->updateSubtreeAbove(this->_hot);  // The loop stops at the rotation, sizes and aggregates above it are changed too
+		this->addToSearchFilter(val);
 
 		// Rotate node to make tree balance
 		for (BinNode<T>* g = this->_hot; g; g = g->parent)
@@ -101,6 +159,7 @@ bool AVLTree<T>::erase(const T & val)
 			}
 			this->updateHeight(g);
 		}
+		this->onErasedForSearchFilter();
 
 		return true;
 	}
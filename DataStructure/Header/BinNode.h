@@ -1,9 +1,12 @@
 #pragma once
+#include <type_traits>
 
 #include "Stack.h"
 #include "Queue.h"
+#include "NodeArena.h"
 
 #define stature(node) ((node)?(node)->height():-1)
+#define subtreeSize(node) ((node)?(node)->size():0)
 
 template<typename T> class BinTree;
 template<typename T> class BinarySearchTree;
@@ -22,11 +25,79 @@ enum TraversalImplementVersion
 	RECURSION,
 	ITERATION_1,
 	ITERATION_2,
+	MORRIS,  // Thread the right links temporarily, no extra memory. Don't touch the tree in func.
 };
 #define DefaultVersion ITERATION_1
 
+// Tag type of a version, every version of traversal is a separate overload so the chosen one is inlined alone.
+template<TraversalImplementVersion Version> struct TraversalVersionTag {};
+
+// Specialize it as true_type to use the compact node format for trees of T, like
+// template<> struct UseCompactBinNode<int> : std::true_type {};
+// Links are 32 bits indices in the node arena of tree, and the node of int takes 24 bytes instead of 40.
+// The arena allocate 256KB slabs, so it's for big trees. Nodes can't be made by new, and attaching a tree copies its nodes.
+template<typename T> struct UseCompactBinNode : std::false_type {};
+
+// Specialize it as true_type to keep the inorder successor in every node of trees of T, then succ() is one load.
+// The links are kept by insert and erase of trees. Moving a subtree by BinTree::attachAsLChild/attachAsRChild
+// doesn't update them, so it must keep the inorder, like the rotations.
+template<typename T> struct UseThreadedBinNode : std::false_type {};
+
+template<typename T> class BinNode;
+template<typename T> using BinNodeLink = typename std::conditional<UseCompactBinNode<T>::value, IndexedNodeLink<BinNode<T>>, BinNode<T>*>::type;
+
+// Augmentation policy keeps an aggregate of every subtree, it's combined bottom-up with the height.
+// The aggregate of a subtree is combine(left, lift(data), right) in inorder, combine must be associative.
+// struct Policy
+// {
+//     typedef ... Value;
+//     static Value identity();
+//     static Value lift(const T& data);
+//     static Value combine(const Value& lhs, const Value& rhs);
+// };
+// Specialize BinNodeAugmentation to use a policy for trees of T, see IntervalTree.h.
+// Don't change the key by getData() in an augmented tree, the aggregates are not updated.
+struct NoAugmentation
+{
+	typedef void Value;
+};
+template<typename T> struct BinNodeAugmentation { typedef NoAugmentation type; };
+
+template<typename Policy>
+class BinNodeAggregate
+{
+public:
+	const typename Policy::Value& aggregate() const { return _aggregate; }
+protected:
+	typename Policy::Value _aggregate;
+};
+
+// Empty base, node without augmentation takes no more space
+template<>
+class BinNodeAggregate<NoAugmentation> {};
+
+// Successor link of threaded node, it's on the aggregate base so both can be empty base
+template<typename Node, typename Link, typename Base, bool Threaded>
+class BinNodeThread : public Base
+{
+protected:
+	BinNodeThread() :next() {}
+	Node* getNext() const { return next; }
+	void setNext(Node* node) { next = node; }
+private:
+	Link next;
+};
+
+template<typename Node, typename Link, typename Base>
+class BinNodeThread<Node, Link, Base, false> : public Base
+{
+protected:
+	Node* getNext() const { return nullptr; }
+	void setNext(Node*) {}
+};
+
 template<typename T>
-class BinNode
+class BinNode : public BinNodeThread<BinNode<T>, BinNodeLink<T>, BinNodeAggregate<typename BinNodeAugmentation<T>::type>, UseThreadedBinNode<T>::value>
 {
 	friend class BinTree<T>;
 	friend class BinarySearchTree<T>;
@@ -36,6 +107,10 @@ class BinNode
 
 public:
 
+	typedef BinNodeLink<T> Link;
+	typedef typename std::conditional<UseCompactBinNode<T>::value, IndexedNodeArena<BinNode<T>>, NodeArena>::type Arena;
+	typedef typename BinNodeAugmentation<T>::type Augmentation;
+
 	// --------------------
 	// Constructor
 	// --------------------
@@ -47,7 +122,7 @@ public:
 		BinNode<T>* inRChild = nullptr,
 		int inHeight = 0,
 		RBColor inColor = RED
-		) :data(inData), parent(inParent), lChild(inLChild), rChild(inRChild), _height(inHeight), _color(inColor)
+		) :data(inData), parent(inParent), lChild(inLChild), rChild(inRChild), _height(inHeight), _color(inColor), _size(1)
 	{}
 private:
 
@@ -56,21 +131,25 @@ private:
 	// --------------------
 
 	T data;
-	BinNode<T>* parent;
-	BinNode<T>* lChild;
-	BinNode<T>* rChild;
+	Link parent;
+	Link lChild;
+	Link rChild;
 
 	// --------------------
 	// Helper member
 	// --------------------
 
-	int _height;
-	RBColor _color;
+	// Share one int, RBColor is signed on MSVC so it takes 2 bits
+	int _height : 30;
+	RBColor _color : 2;
+
+	// Number of nodes in the subtree, updated with the height
+	int _size;
 
 public:
 
 	int height() const { return _height; }
-	int size() const;
+	int size() const { return _size; }
 
 	BinNode<T>* getParent() const{ return parent; }
 	BinNode<T>* getLChild() const{ return lChild; }
@@ -109,46 +188,60 @@ public:
 
 	BinNode<T>* insertAsLChild(BinNode<T>* data);
 	BinNode<T>* insertAsRChild(BinNode<T>* data);
+	// Cut the child off and return it, nullptr if there is no child
+	BinNode<T>* removeLChild();
+	BinNode<T>* removeRChild();
+
+	// The version is chosen at compile time, like node->traversalInorder<MORRIS>(func).
+	// func is called by reference, a functor with state keeps it after traversal.
+	// If func returns bool, returning false stops the traversal. They return false if it's stopped.
+	template<TraversalImplementVersion Version = DefaultVersion, typename FUNC> bool traversalInorder(FUNC&& func) { return traversalInorder(func, TraversalVersionTag<Version>()); }
+	template<TraversalImplementVersion Version = DefaultVersion, typename FUNC> bool traversalPreorder(FUNC&& func) { return traversalPreorder(func, TraversalVersionTag<Version>()); }
+	template<TraversalImplementVersion Version = DefaultVersion, typename FUNC> bool traversalPostorder(FUNC&& func) { return traversalPostorder(func, TraversalVersionTag<Version>()); }
+	template<TraversalImplementVersion Version = DefaultVersion, typename FUNC> bool traversalLevel(FUNC&& func) { return traversalLevel(func, TraversalVersionTag<Version>()); }
+
+	// Inorder successor, nullptr for the last one
+	BinNode<T>* succ();
+	// Inorder predecessor, nullptr for the first one
+	BinNode<T>* pred() { return predInTree(); }
 
-	template<typename FUNC> void traversalInorder(FUNC func, TraversalImplementVersion version = DefaultVersion);
-	template<typename FUNC> void traversalPreorder(FUNC func, TraversalImplementVersion version = DefaultVersion);
-	template<typename FUNC> void traversalPostorder(FUNC func, TraversalImplementVersion version = DefaultVersion);
-	template<typename FUNC> void traversalLevel(FUNC func, TraversalImplementVersion version = DefaultVersion);
+	static const bool IsThreaded = UseThreadedBinNode<T>::value;
 
-	BinNode<T>* succ();
-};
+private:
 
-template<typename T>
-inline int BinNode<T>::size() const
-{
-	/*
-	int sz = 1;
-	if (lChild) sz += lChild->size();
-	if (rChild) sz += rChild->size();
-	return sz;
-	*/
-
-	Stack<const BinNode<T>*> s;
-	const BinNode<T>* p = this;
-	s.push(p);
-	int sz = 0;
-	while (!s.empty())
+	// Walk the links of tree, used to keep the successor links
+	BinNode<T>* succInTree();
+	BinNode<T>* predInTree();
+
+	// Call func on data, return false if func stops the traversal
+	template<typename FUNC> static bool visit(FUNC& func, T& data) { return visit(func, data, std::is_same<decltype(func(data)), bool>()); }
+	template<typename FUNC> static bool visit(FUNC& func, T& data, std::true_type) { return func(data); }
+	template<typename FUNC> static bool visit(FUNC& func, T& data, std::false_type)
 	{
-		if (p->hasLChild()) s.push(p->lChild);
-		if (p->hasRChild())
-		{
-			p = p->rChild;
-			sz += 1;
-		}
-		else
-		{
-			p = s.top();
-			s.pop();
-			sz += 1;
-		}
+		func(data);
+		return true;
 	}
-	return sz;
-}
+
+	template<typename FUNC> bool traversalInorder(FUNC& func, TraversalVersionTag<RECURSION>);
+	template<typename FUNC> bool traversalInorder(FUNC& func, TraversalVersionTag<ITERATION_1>);
+	template<typename FUNC> bool traversalInorder(FUNC& func, TraversalVersionTag<ITERATION_2>);
+	template<typename FUNC> bool traversalInorder(FUNC& func, TraversalVersionTag<MORRIS>);
+
+	template<typename FUNC> bool traversalPreorder(FUNC& func, TraversalVersionTag<RECURSION>);
+	template<typename FUNC> bool traversalPreorder(FUNC& func, TraversalVersionTag<ITERATION_1>);
+	template<typename FUNC> bool traversalPreorder(FUNC& func, TraversalVersionTag<ITERATION_2>);
+	template<typename FUNC> bool traversalPreorder(FUNC& func, TraversalVersionTag<MORRIS>);
+
+	// No MORRIS version of postorder, it needs to reverse the right links. Iteration versions are the same one.
+	template<typename FUNC> bool traversalPostorder(FUNC& func, TraversalVersionTag<RECURSION>);
+	template<typename FUNC, TraversalImplementVersion Version> bool traversalPostorder(FUNC& func, TraversalVersionTag<Version>);
+
+	// Level order has only one version
+	template<typename FUNC, TraversalImplementVersion Version> bool traversalLevel(FUNC& func, TraversalVersionTag<Version>);
+
+	// Remove the links made by MORRIS version when it stops at node
+	void unthreadMorris(BinNode<T>* node);
+};
 
 template<typename T>
 BinNode<T>* BinNode<T>::insertAsLChild(BinNode<T>* data)
@@ -168,8 +261,35 @@ BinNode<T>* BinNode<T>::insertAsRChild(BinNode<T>* data)
 	return rChild;
 }
 
+template<typename T>
+BinNode<T>* BinNode<T>::removeLChild()
+{
+	BinNode<T>* ret = lChild;
+	if (!ret) return nullptr;
+	ret->parent = nullptr;
+	lChild = nullptr;
+	return ret;
+}
+
+template<typename T>
+BinNode<T>* BinNode<T>::removeRChild()
+{
+	BinNode<T>* ret = rChild;
+	if (!ret) return nullptr;
+	ret->parent = nullptr;
+	rChild = nullptr;
+	return ret;
+}
+
 template<typename T>
 inline BinNode<T>* BinNode<T>::succ()
+{
+	if (IsThreaded) return this->getNext();
+	return succInTree();
+}
+
+template<typename T>
+inline BinNode<T>* BinNode<T>::succInTree()
 {
 	BinNode<T>* ret = this;
 	if (hasRChild())
@@ -185,152 +305,289 @@ inline BinNode<T>* BinNode<T>::succ()
 	return ret;
 }
 
+template<typename T>
+inline BinNode<T>* BinNode<T>::predInTree()
+{
+	BinNode<T>* ret = this;
+	if (hasLChild())
+	{
+		ret = lChild;
+		while (ret->hasRChild()) ret = ret->rChild;
+	}
+	else
+	{
+		while (ret->isLChild()) ret = ret->parent;
+		ret = ret->parent;
+	}
+	return ret;
+}
+
 template<typename T>
 template<typename FUNC>
-inline void BinNode<T>::traversalInorder(FUNC func, TraversalImplementVersion version)
+inline bool BinNode<T>::traversalInorder(FUNC& func, TraversalVersionTag<RECURSION> tag)
 {
-	if (version == RECURSION)
+	if (lChild && !lChild->traversalInorder(func, tag)) return false;
+	if (!visit(func, data)) return false;
+	return !rChild || rChild->traversalInorder(func, tag);
+}
+
+template<typename T>
+template<typename FUNC>
+inline bool BinNode<T>::traversalInorder(FUNC& func, TraversalVersionTag<ITERATION_1>)
+{
+	BinNode<T>* p = this;
+	Stack<BinNode<T>*> s;
+	while (true)
 	{
-		if (lChild) lChild->traversalInorder(func);
-		func(data);
-		if (rChild) rChild->traversalInorder(func);
+		if (p)
+		{
+			s.push(p);
+			p = p->lChild;
+		}
+		else if(!s.empty())
+		{
+			p = s.top();
+			s.pop();
+			if (!visit(func, p->data)) return false;
+			p = p->rChild;
+		}
+		else break;
 	}
-	else if (version == ITERATION_1)
+	return true;
+}
+
+template<typename T>
+template<typename FUNC>
+inline bool BinNode<T>::traversalInorder(FUNC& func, TraversalVersionTag<ITERATION_2>)
+{
+	if (IsThreaded)
 	{
+		// Follow the successor links from the first node to the one after the last node of subtree
 		BinNode<T>* p = this;
-		Stack<BinNode<T>*> s;
-		while (true)
+		while (p->hasLChild()) p = p->lChild;
+		BinNode<T>* last = this;
+		while (last->hasRChild()) last = last->rChild;
+		BinNode<T>* end = last->getNext();
+		for (; p != end; p = p->getNext())
+		{
+			if (!visit(func, p->data)) return false;
+		}
+		return true;
+	}
+
+	// use bool to instead stack, use succ(). Take more time but less memory.
+	bool backtrace = false;
+	BinNode<T>* p = this;
+	while (p)
+	{
+		if (!backtrace && p->hasLChild()) p = p->lChild;
+		else
 		{
-			if (p)
+			if (!visit(func, p->data)) return false;
+			if (p->hasRChild())
 			{
-				s.push(p);
-				p = p->lChild;
+				p = p->rChild;
+				backtrace = false;
 			}
-			else if(!s.empty())
+			else
 			{
-				p = s.top();
-				s.pop();
-				func(p->data);
-				p = p->rChild;
+				p = p->succ();
+				backtrace = true;
 			}
-			else break;
 		}
 	}
-	else if (version == ITERATION_2)
+	return true;
+}
+
+template<typename T>
+template<typename FUNC>
+inline bool BinNode<T>::traversalInorder(FUNC& func, TraversalVersionTag<MORRIS>)
+{
+	// Link the rightmost node of left subtree to p, so we can go back to p after the left subtree.
+	// Meet the link again means the left subtree is done, then remove it.
+	BinNode<T>* p = this;
+	while (p)
 	{
-		// use bool to instead stack, use succ(). Take more time but less memory.
-		bool backtrace = false;
-		BinNode<T>* p = this;
-		while (p)
+		if (!p->hasLChild())
 		{
-			if (!backtrace && p->hasLChild()) p = p->lChild;
-			else
+			if (!visit(func, p->data))
 			{
-				func(p->data);
-				if (p->hasRChild())
-				{
-					p = p->rChild;
-					backtrace = false;
-				}
-				else
-				{
-					p = p->succ();
-					backtrace = true;
-				}
+				unthreadMorris(p);
+				return false;
 			}
+			p = p->rChild;
+			continue;
 		}
+		BinNode<T>* pred = p->lChild;
+		while (pred->hasRChild() && pred->rChild != p) pred = pred->rChild;
+		if (!pred->hasRChild())
+		{
+			pred->rChild = p;
+			p = p->lChild;
+		}
+		else
+		{
+			pred->rChild = nullptr;
+			if (!visit(func, p->data))
+			{
+				unthreadMorris(p);
+				return false;
+			}
+			p = p->rChild;
+		}
+	}
+	return true;
+}
+
+template<typename T>
+inline void BinNode<T>::unthreadMorris(BinNode<T>* node)
+{
+	// Every ancestor which has node in its left subtree is not visited yet, its predecessor still links to it.
+	// Walk up to this, where the traversal started.
+	for (BinNode<T>* p = node; p != this; p = p->parent)
+	{
+		if (!p->isLChild()) continue;
+		BinNode<T>* pred = p->parent->lChild;
+		while (pred->rChild != p->parent) pred = pred->rChild;
+		pred->rChild = nullptr;
 	}
 }
 
 template<typename T>
 template<typename FUNC>
-inline void BinNode<T>::traversalPreorder(FUNC func, TraversalImplementVersion version)
+inline bool BinNode<T>::traversalPreorder(FUNC& func, TraversalVersionTag<RECURSION> tag)
 {
-	if (version == RECURSION)
+	if (!visit(func, data)) return false;
+	if (lChild && !lChild->traversalPreorder(func, tag)) return false;
+	return !rChild || rChild->traversalPreorder(func, tag);
+}
+
+template<typename T>
+template<typename FUNC>
+inline bool BinNode<T>::traversalPreorder(FUNC& func, TraversalVersionTag<ITERATION_1>)
+{
+	BinNode<T>* p = this;
+	Stack<BinNode<T>*> s;
+	s.push(p);
+	while (!s.empty())
 	{
-		func(data);
-		if (lChild) lChild->traversalPreorder(func);
-		if (rChild) rChild->traversalPreorder(func);
+		p = s.top();
+		s.pop();
+		if (!visit(func, p->data)) return false;
+
+		// Push rChild first!
+		if (p->hasRChild()) s.push(p->rChild);
+		if (p->hasLChild()) s.push(p->lChild);
 	}
-	else if (version == ITERATION_1)
+	return true;
+}
+
+template<typename T>
+template<typename FUNC>
+inline bool BinNode<T>::traversalPreorder(FUNC& func, TraversalVersionTag<ITERATION_2>)
+{
+	BinNode<T>* p = this;
+	Stack<BinNode<T>*> s;
+	while (p)
 	{
-		BinNode<T>* p = this;
-		Stack<BinNode<T>*> s;
-		s.push(p);
-		while (!s.empty())
+		if (!visit(func, p->data)) return false;
+		if (p->hasRChild()) s.push(p->rChild);
+		if (p->hasLChild())
+		{
+			p = p->lChild;
+		}
+		else
 		{
+			if (s.empty())break;
 			p = s.top();
 			s.pop();
-			func(p->data);
-
-			// Push rChild first!
-			if (p->hasRChild()) s.push(p->rChild);
-			if (p->hasLChild()) s.push(p->lChild);
 		}
 	}
-	else if (version == ITERATION_2)
+	return true;
+}
+
+template<typename T>
+template<typename FUNC>
+inline bool BinNode<T>::traversalPreorder(FUNC& func, TraversalVersionTag<MORRIS>)
+{
+	// Same as inorder, but visit p when going down to the left subtree
+	BinNode<T>* p = this;
+	while (p)
 	{
-		BinNode<T>* p = this;
-		Stack<BinNode<T>*> s;
-		while (p)
+		if (!p->hasLChild())
 		{
-			func(p->data);
-			if (p->hasRChild()) s.push(p->rChild);
-			if (p->hasLChild())
+			if (!visit(func, p->data))
 			{
-				p = p->lChild;
+				unthreadMorris(p);
+				return false;
 			}
-			else
+			p = p->rChild;
+			continue;
+		}
+		BinNode<T>* pred = p->lChild;
+		while (pred->hasRChild() && pred->rChild != p) pred = pred->rChild;
+		if (!pred->hasRChild())
+		{
+			// Stop before the link is made
+			if (!visit(func, p->data))
 			{
-				if (s.empty())break;
-				p = s.top();
-				s.pop();
+				unthreadMorris(p);
+				return false;
 			}
+			pred->rChild = p;
+			p = p->lChild;
+		}
+		else
+		{
+			pred->rChild = nullptr;
+			p = p->rChild;
 		}
 	}
+	return true;
 }
 
 template<typename T>
 template<typename FUNC>
-inline void BinNode<T>::traversalPostorder(FUNC func, TraversalImplementVersion version)
+inline bool BinNode<T>::traversalPostorder(FUNC& func, TraversalVersionTag<RECURSION> tag)
 {
-	if (version == RECURSION)
-	{
-		if (lChild) lChild->traversalPostorder(func);
-		if (rChild) rChild->traversalPostorder(func);
-		func(data);
-	}
-	else if (version == ITERATION_1 || version == ITERATION_2)
+	if (lChild && !lChild->traversalPostorder(func, tag)) return false;
+	if (rChild && !rChild->traversalPostorder(func, tag)) return false;
+	return visit(func, data);
+}
+
+template<typename T>
+template<typename FUNC, TraversalImplementVersion Version>
+inline bool BinNode<T>::traversalPostorder(FUNC& func, TraversalVersionTag<Version>)
+{
+	BinNode<T>* p = this;
+	Stack<BinNode<T>*> s;
+	s.push(p);
+	while (!s.empty())
 	{
-		BinNode<T>* p = this;
-		Stack<BinNode<T>*> s;
-		s.push(p);
-		while (!s.empty())
+		if (s.top() != p->parent)
 		{
-			if (s.top() != p->parent)
+			while (p = s.top())
 			{
-				while (p = s.top())
+				if (p->hasLChild())
 				{
-					if (p->hasLChild())
-					{
-						s.push(p->rChild);
-						s.push(p->lChild);
-					}
-					else
-						s.push(p->rChild);
+					s.push(p->rChild);
+					s.push(p->lChild);
 				}
-				s.pop(); // remove the empty node
+				else
+					s.push(p->rChild);
 			}
-			p = s.top();
-			s.pop();
-			func(p->data);
+			s.pop(); // remove the empty node
 		}
+		p = s.top();
+		s.pop();
+		if (!visit(func, p->data)) return false;
 	}
+	return true;
 }
 
 template<typename T>
-template<typename FUNC>
-inline void BinNode<T>::traversalLevel(FUNC func, TraversalImplementVersion version)
+template<typename FUNC, TraversalImplementVersion Version>
+inline bool BinNode<T>::traversalLevel(FUNC& func, TraversalVersionTag<Version>)
 {
 	BinNode<T>* p = this;
 	Queue<BinNode<T>*> q;
@@ -340,9 +597,10 @@ inline void BinNode<T>::traversalLevel(FUNC func, TraversalImplementVersion vers
 		p = q.front();
 		q.pop();
 
-		func(p->data);
+		if (!visit(func, p->data)) return false;
 
 		if (p->hasLChild()) q.push(p->lChild);
 		if (p->hasRChild()) q.push(p->rChild);
 	}
+	return true;
 }
@@ -1,19 +1,42 @@
 #pragma once
 #include <iomanip>
+#include <iterator>
+#include <type_traits>
 #include "BinNode.h"
+#include "ThreadPool.h"
 
 template<typename T>
 class BinTree
 {
 public:
-	BinTree(BinNode<T>* inRoot = nullptr) :_root(inRoot) { _size = inRoot ? inRoot->size() : 0; }
-	~BinTree() { remove(_root); }
+	BinTree() :_root(nullptr), _size(0), arena(new SharedArena(sizeof(BinNode<T>))) {}
+	~BinTree();
+
+	BinTree(const BinTree&) = delete;
+	BinTree& operator=(const BinTree&) = delete;
 
 protected:
 
+	typedef typename BinNode<T>::Arena Arena;
+
 	BinNode<T>* _root;
 	int _size;
 
+	// The arena is shared by the trees seceded from one tree, it's deleted with the last of them.
+	// Trees sharing an arena can't be changed on different threads at once.
+	struct SharedArena : Arena
+	{
+		explicit SharedArena(size_t nodeSize) :Arena(nodeSize), shareCount(1) {}
+		int shareCount;
+	};
+
+	// Nodes of the tree are allocated from its arena
+	SharedArena* arena;
+
+	bool isArenaShared() const { return arena->shareCount > 1; }
+	// Allocate from the arena of tree from now on, this tree must be empty
+	void shareArenaOf(BinTree& tree);
+
 public:
 
 	int size() const { return _size; }
@@ -33,7 +56,8 @@ public:
 	BinNode<T>* attachAsLChild(BinNode<T>* parent, BinNode<T>* node);
 	BinNode<T>* attachAsRChild(BinNode<T>* parent, BinNode<T>* node);
 
-	// Attach another tree to one node
+	// Attach another tree to one node, the nodes and the arena of tree are moved to this tree.
+	// The nodes are copied if they can't be moved, like the compact nodes or an arena shared with other trees.
 	// Return the original root node of tree that added
 	BinNode<T>* attachAsLChild(BinNode<T>* parent, BinTree& tree);
 	BinNode<T>* attachAsRChild(BinNode<T>* parent, BinTree& tree);
@@ -41,13 +65,44 @@ public:
 	// Remove the subtree from given node
 	BinNode<T>* remove(BinNode<T>* node);
 
-	// Move the subtree from given node to a new tree
+	// Move the subtree from given node to a new tree in O(1), the nodes stay where they are.
+	// The new tree shares the arena of this tree.
 	BinTree<T>* secede(BinNode<T>* node);
 
-	template<typename FUNC> void traversalInorder(FUNC func) { if (_root)_root->traversalInorder(func); }
-	template<typename FUNC> void traversalPreorder(FUNC func) { if (_root)_root->traversalPreorder(func); }
-	template<typename FUNC> void traversalPostorder(FUNC func) { if (_root)_root->traversalPostorder(func); }
-	template<typename FUNC> void traversalLevel(FUNC func) { if (_root)_root->traversalLevel(func); }
+	template<TraversalImplementVersion Version = DefaultVersion, typename FUNC> bool traversalInorder(FUNC&& func) { return !_root || _root->template traversalInorder<Version>(func); }
+	template<TraversalImplementVersion Version = DefaultVersion, typename FUNC> bool traversalPreorder(FUNC&& func) { return !_root || _root->template traversalPreorder<Version>(func); }
+	template<TraversalImplementVersion Version = DefaultVersion, typename FUNC> bool traversalPostorder(FUNC&& func) { return !_root || _root->template traversalPostorder<Version>(func); }
+	template<TraversalImplementVersion Version = DefaultVersion, typename FUNC> bool traversalLevel(FUNC&& func) { return !_root || _root->template traversalLevel<Version>(func); }
+
+	// --------------------
+	// Lazy traversal, the next node is found when the iterator goes forward.
+	// Break the loop to stop early, the first k nodes of inorder cost O(log n + k).
+	//     for (auto& data : tree.inorder()) ...
+	// Don't change the tree while iterating.
+	// --------------------
+
+	template<typename Cursor> class Generator;
+	class InorderCursor;
+	class PreorderCursor;
+	class LevelCursor;
+
+	Generator<InorderCursor> inorder() const { return Generator<InorderCursor>(_root); }
+	Generator<PreorderCursor> preorder() const { return Generator<PreorderCursor>(_root); }
+	Generator<LevelCursor> levelOrder() const { return Generator<LevelCursor>(_root); }
+
+	// --------------------
+	// Fork-join traversal on the pool, subtrees are split to tasks until they are small or deep enough.
+	// Don't change the tree during them.
+	// --------------------
+
+	// Call func(data) for every node, in no certain order and from many threads at once.
+	template<typename FUNC> void parallelTraversal(FUNC&& func, ThreadPool& pool = ThreadPool::instance());
+
+	// Fold map(data) of the subtree from node in inorder, like combine(combine(map(a), map(b)), map(c)).
+	// combine must be associative but needn't be commutative. The result type must be default constructible.
+	template<typename MAP, typename COMBINE>
+	auto parallelReduce(BinNode<T>* node, MAP&& map, COMBINE&& combine, ThreadPool& pool = ThreadPool::instance())
+		-> typename std::decay<decltype(map(node->data))>::type;
 
 	bool operator==(const BinTree& tree) { return _root && tree._root&&_root == tree._root; }
 	bool operator!=(const BinTree& tree) { return !(*this == tree); }
@@ -59,19 +114,220 @@ public:
 
 protected:
 
+	// Update the height and the subtree size
 	virtual void updateHeight(BinNode<T>* node);
 	void updateHeightAbove(BinNode<T>* node);
 
-	BinNode<T>*& fromParentTo(const BinNode<T>* node);
+	// Only update the subtree size and aggregate, used when the height is fixed later by rebalancing
+	void updateSubtree(BinNode<T>* node)
+	{
+		node->_size = subtreeSize(node->lChild) + subtreeSize(node->rChild) + 1;
+		updateAggregate(node, std::integral_constant<bool, !std::is_same<typename BinNode<T>::Augmentation, NoAugmentation>::value>());
+	}
+	void updateSubtreeAbove(BinNode<T>* node);
+
+	// Keep the successor links of threaded tree, they do nothing if it's not threaded.
+	// Call threadInserted after a new node is linked, and unthreadNode before a node is erased.
+	void threadInserted(BinNode<T>* node);
+	void unthreadNode(BinNode<T>* node);
+	// Call unthreadSubtree before a subtree is cut off, and threadSubtree after it's attached
+	void unthreadSubtree(BinNode<T>* node);
+	void threadSubtree(BinNode<T>* node);
+	// Link all nodes of a subtree which is not in the tree yet, the last one links to nullptr
+	void threadDetached(BinNode<T>* node);
+
+	// The link from parent to node, or _root if node is the root of tree. Assign to it to replace the node.
+	class ParentLink
+	{
+	public:
+		ParentLink(typename BinNode<T>::Link* inLink, BinNode<T>** inRoot) :link(inLink), root(inRoot) {}
+
+		ParentLink& operator=(BinNode<T>* node)
+		{
+			if (link) *link = node;
+			else if (root) *root = node;
+			return *this;
+		}
+
+	private:
+		typename BinNode<T>::Link* link;
+		BinNode<T>** root;
+	};
+
+	ParentLink fromParentTo(const BinNode<T>* node);
+
+	BinNode<T>* createNode(const T& data)
+	{
+		BinNode<T>* node = new (arena->allocate()) BinNode<T>(data);
+		updateSubtree(node);
+		return node;
+	}
+	void destroyNode(BinNode<T>* node)
+	{
+		node->~BinNode<T>();
+		arena->deallocate(node);
+	}
 
 	virtual void internalPrintData(int currentHeight, int wordWidth, BinNode<T>* node);
 
+	// Take all nodes of tree, return the root of them in this tree
+	BinNode<T>* adoptTree(BinTree& tree);
+
+	// Call destroy on every node of the subtree, not recursive.
+	template<typename FUNC> static void destroySubtree(BinNode<T>* node, FUNC destroy);
+
+	// Subtrees smaller than grain or deeper than depth are done by one task.
+	// The depth limit keeps a degenerated tree from forking along a long path.
+	static const int ParallelMinGrain = 2048;
+	static int parallelGrain(int size, const ThreadPool& pool);
+	static int parallelDepth(const ThreadPool& pool);
+
 private:
 
+	void updateAggregate(BinNode<T>*, std::false_type) {}
+	void updateAggregate(BinNode<T>* node, std::true_type);
+
 	void internalRemove(BinNode<T>* node);
 
+	BinNode<T>* adoptTree(BinTree& tree, std::true_type canMerge);
+	BinNode<T>* adoptTree(BinTree& tree, std::false_type canMerge);
+
+	// Copy the subtree to the arena, return the root of copy
+	BinNode<T>* copySubtree(const BinNode<T>* node);
+
+	template<typename FUNC> static void parallelTraversal(BinNode<T>* node, FUNC& func, ThreadPool& pool, int grain, int depth);
+	template<typename R, typename MAP, typename COMBINE>
+	static R parallelReduce(BinNode<T>* node, MAP& map, COMBINE& combine, ThreadPool& pool, int grain, int depth);
+
+};
+
+// The saved state of lazy traversal, next() returns the next node or nullptr at the end
+template<typename T>
+class BinTree<T>::InorderCursor
+{
+public:
+	explicit InorderCursor(BinNode<T>* root = nullptr) :p(root) {}
+
+	BinNode<T>* next()
+	{
+		// Go down to the leftmost node of p, the stack keeps the nodes whose left subtree is not done
+		for (; p; p = p->lChild) s.push(p);
+		if (s.empty()) return nullptr;
+		BinNode<T>* ret = s.top();
+		s.pop();
+		p = ret->rChild;
+		return ret;
+	}
+
+private:
+	BinNode<T>* p;
+	Stack<BinNode<T>*> s;
+};
+
+template<typename T>
+class BinTree<T>::PreorderCursor
+{
+public:
+	explicit PreorderCursor(BinNode<T>* root = nullptr)
+	{
+		if (root) s.push(root);
+	}
+
+	BinNode<T>* next()
+	{
+		if (s.empty()) return nullptr;
+		BinNode<T>* ret = s.top();
+		s.pop();
+		if (ret->hasRChild()) s.push(ret->rChild);
+		if (ret->hasLChild()) s.push(ret->lChild);
+		return ret;
+	}
+
+private:
+	Stack<BinNode<T>*> s;
+};
+
+template<typename T>
+class BinTree<T>::LevelCursor
+{
+public:
+	explicit LevelCursor(BinNode<T>* root = nullptr)
+	{
+		if (root) q.push(root);
+	}
+
+	BinNode<T>* next()
+	{
+		if (q.empty()) return nullptr;
+		BinNode<T>* ret = q.front();
+		q.pop();
+		if (ret->hasLChild()) q.push(ret->lChild);
+		if (ret->hasRChild()) q.push(ret->rChild);
+		return ret;
+	}
+
+private:
+	Queue<BinNode<T>*> q;
 };
 
+template<typename T>
+template<typename Cursor>
+class BinTree<T>::Generator
+{
+public:
+	class Iterator
+	{
+	public:
+		typedef std::input_iterator_tag iterator_category;
+		typedef T value_type;
+		typedef int difference_type;
+		typedef T* pointer;
+		typedef T& reference;
+
+		Iterator() :node(nullptr) {}
+		explicit Iterator(BinNode<T>* root) :cursor(root), node(cursor.next()) {}
+
+		T& operator*() const
+		{
+			assert(node);
+			return node->data;
+		}
+		T* operator->() const { return &**this; }
+		BinNode<T>* getNode() const { return node; }
+
+		Iterator& operator++()
+		{
+			assert(node);
+			node = cursor.next();
+			return *this;
+		}
+
+		// Only compared with end()
+		bool operator==(const Iterator& rhs) const { return node == rhs.node; }
+		bool operator!=(const Iterator& rhs) const { return !(*this == rhs); }
+
+	private:
+		Cursor cursor;
+		BinNode<T>* node;
+	};
+
+	explicit Generator(BinNode<T>* inRoot) :root(inRoot) {}
+
+	// Every call starts a new traversal
+	Iterator begin() const { return Iterator(root); }
+	Iterator end() const { return Iterator(); }
+
+private:
+	BinNode<T>* root;
+};
+
+template<typename T>
+BinTree<T>::~BinTree()
+{
+	remove(_root);
+	if (--arena->shareCount == 0) delete arena;
+}
+
 template<typename T>
 inline BinNode<T>* BinTree<T>::zig(BinNode<T>* node)
 {
@@ -175,6 +431,27 @@ inline void BinTree<T>::updateHeight(BinNode<T>* node)
 	int lHeight = stature(node->lChild);
 	int rHeight = stature(node->rChild);
 	node->_height = (lHeight > rHeight ? lHeight : rHeight) + 1;
+	updateSubtree(node);
+}
+
+template<typename T>
+inline void BinTree<T>::updateAggregate(BinNode<T>* node, std::true_type)
+{
+	typedef typename BinNode<T>::Augmentation Policy;
+	typename Policy::Value value = Policy::lift(node->data);
+	if (node->lChild) value = Policy::combine(node->lChild->_aggregate, value);
+	if (node->rChild) value = Policy::combine(value, node->rChild->_aggregate);
+	node->_aggregate = value;
+}
+
+template<typename T>
+inline void BinTree<T>::updateSubtreeAbove(BinNode<T>* node)
+{
+	while (node)
+	{
+		updateSubtree(node);
+		node = node->parent;
+	}
 }
 
 template<typename T>
@@ -191,7 +468,7 @@ template<typename T>
 inline BinNode<T>* BinTree<T>::insertAsRoot(const T& data)
 {
 	assert(!_root);
-	_root = new BinNode<T>(data);
+	_root = createNode(data);
 	_size = 1;
 	return _root;
 }
@@ -200,8 +477,9 @@ template<typename T>
 inline BinNode<T>* BinTree<T>::insertAsLChild(BinNode<T>* parent, const T & data)
 {
 	assert(parent);
-	BinNode<T>* node = new BinNode<T>(data);
+	BinNode<T>* node = createNode(data);
 	parent->insertAsLChild(node);
+	threadInserted(node);
 	++_size;
 	updateHeightAbove(parent);
 	return parent->lChild;
@@ -211,8 +489,9 @@ template<typename T>
 inline BinNode<T>* BinTree<T>::insertAsRChild(BinNode<T>* parent, const T & data)
 {
 	assert(parent);
-	BinNode<T>* node = new BinNode<T>(data);
+	BinNode<T>* node = createNode(data);
 	parent->insertAsRChild(node);
+	threadInserted(node);
 	++_size;
 	updateHeightAbove(parent);
 	return parent->rChild;
@@ -251,11 +530,10 @@ inline BinNode<T>* BinTree<T>::attachAsLChild(BinNode<T>* parent, BinTree & tree
 {
 	assert(parent && !parent->lChild);
 	if (!tree._root) return nullptr;
-	parent->lChild = tree._root;
-	tree._root->parent = parent;
-	tree._root = nullptr;
-	_size += tree._size;
-	tree._size = 0;
+	BinNode<T>* node = adoptTree(tree);
+	parent->lChild = node;
+	node->parent = parent;
+	threadSubtree(node);
 	updateHeightAbove(parent);
 	return parent->lChild;
 }
@@ -265,11 +543,10 @@ inline BinNode<T>* BinTree<T>::attachAsRChild(BinNode<T>* parent, BinTree & tree
 {
 	assert(parent && !parent->rChild);
 	if (!tree._root) return nullptr;
-	parent->rChild = tree._root;
-	tree._root->parent = parent;
-	tree._root = nullptr;
-	_size += tree._size;
-	tree._size = 0;
+	BinNode<T>* node = adoptTree(tree);
+	parent->rChild = node;
+	node->parent = parent;
+	threadSubtree(node);
 	updateHeightAbove(parent);
 	return parent->rChild;
 }
@@ -281,9 +558,21 @@ inline BinNode<T>* BinTree<T>::remove(BinNode<T>* node)
 	BinNode<T>* ret = node->parent;
 	if (node->parent)
 	{
+		unthreadSubtree(node);
 		fromParentTo(node) = nullptr;
 		updateHeightAbove(node->parent);
 	}
+	else if (node == _root)
+	{
+		_root = nullptr;
+		if (std::is_trivially_destructible<T>::value && !isArenaShared())
+		{
+			// Nothing to destruct, release the slabs without visiting the nodes
+			arena->releaseAll();
+			_size = 0;
+			return ret;
+		}
+	}
 	internalRemove(node);
 	return ret;
 }
@@ -292,11 +581,130 @@ template<typename T>
 inline void BinTree<T>::internalRemove(BinNode<T>* node)
 {
 	assert(node);
-	if (node->lChild) internalRemove(node->lChild);
-	if (node->rChild) internalRemove(node->rChild);
-	delete node;
-	node = nullptr;
-	--_size;
+	destroySubtree(node, [this](BinNode<T>* p)
+	{
+		destroyNode(p);
+		--_size;
+	});
+}
+
+template<typename T>
+template<typename FUNC>
+inline void BinTree<T>::destroySubtree(BinNode<T>* node, FUNC destroy)
+{
+	// Not recursive, a degenerated tree can be too deep for the call stack.
+	// Rotate the left child up until there is no left child, then the node can be removed with its right subtree left.
+	while (node)
+	{
+		if (node->lChild)
+		{
+			BinNode<T>* lc = node->lChild;
+			node->lChild = lc->rChild;
+			lc->rChild = node;
+			node = lc;
+		}
+		else
+		{
+			BinNode<T>* rc = node->rChild;
+			destroy(node);
+			node = rc;
+		}
+	}
+}
+
+template<typename T>
+inline int BinTree<T>::parallelGrain(int size, const ThreadPool& pool)
+{
+	// About 8 tasks for every thread, so idle threads have something to steal
+	const int grain = size / static_cast<int>(pool.threadCount() * 8);
+	return grain > ParallelMinGrain ? grain : ParallelMinGrain;
+}
+
+template<typename T>
+inline int BinTree<T>::parallelDepth(const ThreadPool& pool)
+{
+	int depth = 4;
+	for (unsigned n = pool.threadCount(); n > 1; n >>= 1) depth += 2;
+	return depth;
+}
+
+template<typename T>
+template<typename FUNC>
+inline void BinTree<T>::parallelTraversal(FUNC&& func, ThreadPool& pool)
+{
+	if (!_root) return;
+	if (pool.threadCount() == 1)
+	{
+		_root->traversalPreorder(func);
+		return;
+	}
+	parallelTraversal(_root, func, pool, parallelGrain(subtreeSize(_root), pool), parallelDepth(pool));
+}
+
+template<typename T>
+template<typename FUNC>
+inline void BinTree<T>::parallelTraversal(BinNode<T>* node, FUNC& func, ThreadPool& pool, int grain, int depth)
+{
+	if (depth == 0 || subtreeSize(node) < grain)
+	{
+		node->traversalPreorder(func);
+		return;
+	}
+
+	// Fork the left subtree, and do the right one in this thread
+	ThreadPool::TaskGroup group(pool);
+	if (node->lChild)
+	{
+		BinNode<T>* lc = node->lChild;
+		group.run([lc, &func, &pool, grain, depth]() { parallelTraversal(lc, func, pool, grain, depth - 1); });
+	}
+	func(node->data);
+	if (node->rChild) parallelTraversal(node->rChild, func, pool, grain, depth - 1);
+	group.wait();
+}
+
+template<typename T>
+template<typename MAP, typename COMBINE>
+inline auto BinTree<T>::parallelReduce(BinNode<T>* node, MAP&& map, COMBINE&& combine, ThreadPool& pool)
+	-> typename std::decay<decltype(map(node->data))>::type
+{
+	typedef typename std::decay<decltype(map(node->data))>::type R;
+	assert(node);
+	const int grain = pool.threadCount() == 1 ? subtreeSize(node) + 1 : parallelGrain(subtreeSize(node), pool);
+	return parallelReduce<R>(node, map, combine, pool, grain, parallelDepth(pool));
+}
+
+template<typename T>
+template<typename R, typename MAP, typename COMBINE>
+inline R BinTree<T>::parallelReduce(BinNode<T>* node, MAP& map, COMBINE& combine, ThreadPool& pool, int grain, int depth)
+{
+	if (depth == 0 || subtreeSize(node) < grain)
+	{
+		BinNode<T>* first = node;
+		while (first->lChild) first = first->lChild;
+		R ret = map(first->data);
+		bool isFirst = true;
+		node->traversalInorder([&](const T& data)
+		{
+			if (isFirst) isFirst = false;
+			else ret = combine(ret, map(data));
+		});
+		return ret;
+	}
+
+	// Fork the left subtree, then combine the results in order: left, node, right
+	R left = R();
+	ThreadPool::TaskGroup group(pool);
+	if (node->lChild)
+	{
+		BinNode<T>* lc = node->lChild;
+		group.run([lc, &left, &map, &combine, &pool, grain, depth]() { left = parallelReduce<R>(lc, map, combine, pool, grain, depth - 1); });
+	}
+	R ret = map(node->data);
+	if (node->rChild) ret = combine(ret, parallelReduce<R>(node->rChild, map, combine, pool, grain, depth - 1));
+	group.wait();
+	if (node->lChild) ret = combine(left, ret);
+	return ret;
 }
 
 template<typename T>
@@ -304,22 +712,190 @@ inline BinTree<T>* BinTree<T>::secede(BinNode<T>* node)
 {
 	if (node->parent)
 	{
+		unthreadSubtree(node);
 		fromParentTo(node) = nullptr;
 		updateHeightAbove(node->parent);
 	}
+	else if (node == _root)
+	{
+		_root = nullptr;
+	}
 	node->parent = nullptr;
-	BinTree<T>* newTree =  new BinTree<T>(node);
-	newTree->_size = node->size();
+
+	// The new tree takes the nodes and shares the arena
+	BinTree<T>* newTree = new BinTree<T>;
+	newTree->shareArenaOf(*this);
+	newTree->_root = node;
+	newTree->_size = subtreeSize(node);
 	_size -= newTree->_size;
 	return newTree;
 }
 
 template<typename T>
-inline BinNode<T>*& BinTree<T>::fromParentTo(const BinNode<T>* node)
+inline void BinTree<T>::shareArenaOf(BinTree& tree)
+{
+	assert(!_root);
+	if (arena == tree.arena) return;
+	if (--arena->shareCount == 0) delete arena;
+	arena = tree.arena;
+	++arena->shareCount;
+}
+
+template<typename T>
+inline BinNode<T>* BinTree<T>::adoptTree(BinTree& tree)
+{
+	if (!tree._root) return nullptr;
+	if (tree.arena == arena)
+	{
+		// Seceded from this tree or the same family, the nodes are in our arena already
+		BinNode<T>* node = tree._root;
+		tree._root = nullptr;
+		_size += tree._size;
+		tree._size = 0;
+		return node;
+	}
+	// Other trees still use the slabs of a shared arena, they can't be merged
+	if (tree.isArenaShared()) return adoptTree(tree, std::false_type());
+	return adoptTree(tree, std::integral_constant<bool, Arena::CanMerge>());
+}
+
+template<typename T>
+inline BinNode<T>* BinTree<T>::adoptTree(BinTree& tree, std::true_type)
+{
+	// Nodes stay where they are, the arena of tree is merged to this one
+	BinNode<T>* node = tree._root;
+	tree._root = nullptr;
+	arena->merge(*tree.arena);
+	_size += tree._size;
+	tree._size = 0;
+	return node;
+}
+
+template<typename T>
+inline BinNode<T>* BinTree<T>::adoptTree(BinTree& tree, std::false_type)
+{
+	// Index can't be moved to another arena, and the slabs of a shared arena can't be taken, copy the nodes
+	BinNode<T>* node = copySubtree(tree._root);
+	tree.remove(tree._root);
+	return node;
+}
+
+template<typename T>
+inline BinNode<T>* BinTree<T>::copySubtree(const BinNode<T>* node)
+{
+	// Copy in preorder with two stacks
+	BinNode<T>* ret = createNode(node->data);
+	Stack<const BinNode<T>*> source;
+	Stack<BinNode<T>*> target;
+	Vector<BinNode<T>*> copied;
+	source.push(node);
+	target.push(ret);
+	while (!source.empty())
+	{
+		const BinNode<T>* from = source.top();
+		BinNode<T>* to = target.top();
+		source.pop();
+		target.pop();
+		copied.push_back(to);
+		to->_height = from->_height;
+		to->_color = from->_color;
+		if (from->lChild)
+		{
+			to->insertAsLChild(createNode(from->lChild->data));
+			source.push(from->lChild);
+			target.push(to->lChild);
+		}
+		if (from->rChild)
+		{
+			to->insertAsRChild(createNode(from->rChild->data));
+			source.push(from->rChild);
+			target.push(to->rChild);
+		}
+		++_size;
+	}
+
+	// Children are after their parent in preorder, count the sizes backward
+	for (int i = static_cast<int>(copied.size()) - 1; i >= 0; --i) updateSubtree(copied[i]);
+
+	threadDetached(ret);
+	return ret;
+}
+
+template<typename T>
+inline void BinTree<T>::threadDetached(BinNode<T>* node)
+{
+	if (!BinNode<T>::IsThreaded) return;
+	BinNode<T>* last = nullptr;
+	BinNode<T>* p = node;
+	Stack<BinNode<T>*> s;
+	while (p || !s.empty())
+	{
+		if (p)
+		{
+			s.push(p);
+			p = p->lChild;
+			continue;
+		}
+		p = s.top();
+		s.pop();
+		if (last) last->setNext(p);
+		last = p;
+		p = p->rChild;
+	}
+	last->setNext(nullptr);
+}
+
+template<typename T>
+inline void BinTree<T>::threadInserted(BinNode<T>* node)
+{
+	if (!BinNode<T>::IsThreaded) return;
+	BinNode<T>* pred = node->predInTree();
+	node->setNext(node->succInTree());
+	if (pred) pred->setNext(node);
+}
+
+template<typename T>
+inline void BinTree<T>::unthreadNode(BinNode<T>* node)
+{
+	if (!BinNode<T>::IsThreaded) return;
+	BinNode<T>* pred = node->predInTree();
+	if (pred) pred->setNext(node->getNext());
+}
+
+template<typename T>
+inline void BinTree<T>::unthreadSubtree(BinNode<T>* node)
+{
+	if (!BinNode<T>::IsThreaded) return;
+	BinNode<T>* first = node;
+	while (first->lChild) first = first->lChild;
+	BinNode<T>* last = node;
+	while (last->rChild) last = last->rChild;
+	BinNode<T>* pred = first->predInTree();
+	if (pred) pred->setNext(last->getNext());
+	last->setNext(nullptr);
+}
+
+template<typename T>
+inline void BinTree<T>::threadSubtree(BinNode<T>* node)
+{
+	// Links in the subtree are kept, only link its first and last node to the tree
+	if (!BinNode<T>::IsThreaded) return;
+	BinNode<T>* first = node;
+	while (first->lChild) first = first->lChild;
+	BinNode<T>* last = node;
+	while (last->rChild) last = last->rChild;
+	BinNode<T>* pred = first->predInTree();
+	if (pred) pred->setNext(first);
+	last->setNext(last->succInTree());
+}
+
+template<typename T>
+inline typename BinTree<T>::ParentLink BinTree<T>::fromParentTo(const BinNode<T>* node)
 {
 	// This assume given node is in this tree
-	if (node->isLChild()) return node->parent->lChild;
-	else if (node->isRChild()) return node->parent->rChild;
-	else if (node->isRoot()) return _root;
-	else assert(false);		
+	if (node->isLChild()) return ParentLink(&node->parent->lChild, nullptr);
+	else if (node->isRChild()) return ParentLink(&node->parent->rChild, nullptr);
+	assert(node->isRoot());
+	// The root of a detached subtree has no link, like the ones in the middle of join and split
+	return ParentLink(nullptr, node == _root ? &_root : nullptr);
 }
\ No newline at end of file
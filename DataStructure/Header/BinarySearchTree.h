@@ -1,5 +1,19 @@
 #pragma once
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <typeinfo>
+
 #include "BinTree.h"
+#include "BloomFilter.h"
+
+struct SearchFilterStats
+{
+	unsigned long long hits;  // Searches answered by the filter without walking the tree
+	unsigned long long misses;  // Searches the filter passed to the tree
+	unsigned long long falsePositives;  // Passed searches that are not found in the tree
+	unsigned long long rebuilds;
+};
 
 template<typename T>
 class BinarySearchTree : public BinTree<T>
@@ -10,26 +24,312 @@ protected:
 
 public:
 
+	~BinarySearchTree() { delete searchFilter; }
+
 	virtual BinNode<T>* search(const T& val);
 	virtual BinNode<T>* searchIn(BinNode<T>* r, const T& val);
 
 	virtual BinNode<T>* insert(const T& val);
 	virtual bool erase(const T& val);
 
+	// --------------------
+	// Iterator, it moves by succ() and pred(). Insert and erase of other nodes don't invalidate it.
+	// --------------------
+
+	template<bool Reverse> class TreeIterator;
+	typedef TreeIterator<false> Iterator;
+	typedef TreeIterator<true> ReverseIterator;
+
+	// Iterators in [b, e), used by range-based for
+	struct Range
+	{
+		Iterator b;
+		Iterator e;
+		Iterator begin() const { return b; }
+		Iterator end() const { return e; }
+	};
+
+	Iterator begin() const { return Iterator(this, this->_root ? leftmost(this->_root) : nullptr); }
+	Iterator end() const { return Iterator(this, nullptr); }
+	ReverseIterator rbegin() const { return ReverseIterator(this, this->_root ? rightmost(this->_root) : nullptr); }
+	ReverseIterator rend() const { return ReverseIterator(this, nullptr); }
+
+	// First key not less than val, and first key greater than val. They don't splay in SplayTree.
+	Iterator lower_bound(const T& val) const;
+	Iterator upper_bound(const T& val) const;
+	Range equal_range(const T& val) const { return Range{ lower_bound(val), upper_bound(val) }; }
+
+	// Keys in [lo, hi), O(log n) to find the begin and O(1) amortized for each key
+	Range range(const T& lo, const T& hi) const { return lo < hi ? Range{ lower_bound(lo), lower_bound(hi) } : Range{ end(), end() }; }
+
+	// --------------------
+	// Order statistics, O(log n) with the subtree size in nodes
+	// --------------------
+
+	// The k-th smallest node, k starts from 0. Return nullptr if k is out of range.
+	BinNode<T>* select(int k) const;
+	// Number of keys less than val
+	int rank(const T& val) const;
+	// Number of keys in [lo, hi)
+	int countRange(const T& lo, const T& hi) const { return lo < hi ? rank(hi) - rank(lo) : 0; }
+
+	// Aggregate of keys in [lo, hi) in O(log n), only for the tree with augmentation policy
+	typename BinNode<T>::Augmentation::Value aggregate(const T& lo, const T& hi) const;
+
+	// --------------------
+	// Bulk load
+	// --------------------
+
+	// Replace all keys of the tree with [b, e), which must be sorted without equal keys.
+	// The tree is built perfectly balanced in O(n), with the heights for AVLTree and the colors for RedBlackTree.
+	// Nodes are allocated in inorder. If parallel, big halves are built on the pool in their own arenas, which are merged after.
+	template<typename Iter> void buildFromSorted(Iter b, Iter e, bool parallel = false, ThreadPool& pool = ThreadPool::instance());
+
+	// --------------------
+	// Split, join and set operations. AVLTree and RedBlackTree keep balanced by their height and black height,
+	// other trees are only linked. Both trees must be the same kind of tree, and other is empty after.
+	// Nodes of other are moved in O(1) if it uses the same arena or the arena can be merged,
+	// the compact format and an arena shared with a third tree copy them.
+	// --------------------
+
+	// Append key and the keys of right, they must be greater than all keys of this tree. O(log n).
+	void join(const T& key, BinarySearchTree& right);
+	// Append the keys of right, they must be greater than all keys of this tree. O(log n).
+	void join(BinarySearchTree& right);
+	// Move the keys not less than key to right, which must be empty. O(log n).
+	// Nodes stay where they are, right shares the arena of this tree like a seceded tree.
+	void split(const T& key, BinarySearchTree& right);
+
+	// Divide and conquer on the pool, the two halves of every step run in parallel.
+	// O(m log(n / m + 1)) work for trees of n and m keys, m <= n. A threaded tree relinks all nodes after.
+	void unionWith(BinarySearchTree& other, ThreadPool& pool = ThreadPool::instance());
+	void intersectWith(BinarySearchTree& other, ThreadPool& pool = ThreadPool::instance());
+	// Erase the keys of other
+	void difference(BinarySearchTree& other, ThreadPool& pool = ThreadPool::instance());
+
+	// Attach a Bloom filter so search return most misses without walking the tree.
+	// It's updated on insert and rebuilt on next search after many erase, or when the tree grows over its capacity.
+	template<typename Hash = std::hash<T>>
+	void enableSearchFilter(double falsePositiveRate = 0.01, size_t memoryBudget = 0);
+	void disableSearchFilter();
+	const BlockedBloomFilter* getSearchFilter() const { return searchFilter; }
+	const SearchFilterStats& getSearchFilterStats() const { return searchFilterStats; }
+
 protected:
 
+	// Call after a node is inserted or erased
+	void addToSearchFilter(const T& val);
+	void onErasedForSearchFilter();
+
 	// Remember updateHeightAbove on return node's parent
 	BinNode<T>* connect34(BinNode<T>* a, BinNode<T>* b, BinNode<T>* c, BinNode<T>* T0, BinNode<T>* T1, BinNode<T>* T2, BinNode<T>* T3);
 	BinNode<T>* rotateAt(BinNode<T>* v);
 
 	void swap(BinNode<T>*& val1, BinNode<T>*& val2);
 
+	// Join detached subtrees, all keys of l < key of k < all keys of r. The root of result has no parent.
+	// The overrides keep the tree balanced, they must not touch _root, so the subtrees can be joined in parallel.
+	virtual BinNode<T>* joinNodes(BinNode<T>* l, BinNode<T>* k, BinNode<T>* r);
+	BinNode<T>* joinNodes(BinNode<T>* l, BinNode<T>* r);
+	// Split the detached subtree t to keys less than key and keys greater than key, return the node of key or nullptr
+	BinNode<T>* splitNodes(BinNode<T>* t, const T& key, BinNode<T>*& l, BinNode<T>*& r);
+
+	// Called when a root is set by join, split and set operations, RedBlackTree makes it black
+	virtual void settleRoot(BinNode<T>*) {}
+
 	BinNode<T>* eraseAt(BinNode<T>* pos);
+
+private:
+
+	static BinNode<T>* leftmost(BinNode<T>* node)
+	{
+		while (node->lChild) node = node->lChild;
+		return node;
+	}
+	static BinNode<T>* rightmost(BinNode<T>* node)
+	{
+		while (node->rChild) node = node->rChild;
+		return node;
+	}
+
+	typedef typename BinTree<T>::Arena Arena;
+
+	// Build the nodes of [b, e) at depth, nodes at redDepth are red
+	template<typename Iter> BinNode<T>* buildSubtree(Iter b, Iter e, int depth, int redDepth, Arena& arena);
+	template<typename Iter> BinNode<T>* buildSubtree(Iter b, Iter e, int depth, int redDepth, Arena& arena, ThreadPool& pool, int grain, std::true_type canMerge);
+	template<typename Iter> BinNode<T>* buildSubtree(Iter b, Iter e, int depth, int redDepth, Arena& arena, ThreadPool&, int, std::false_type)
+	{
+		return buildSubtree(b, e, depth, redDepth, arena);
+	}
+	BinNode<T>* linkBuilt(BinNode<T>* node, BinNode<T>* lc, BinNode<T>* rc, int depth, int redDepth);
+
+	// Nodes removed by a set operation are destroyed after it, the arena is not thread safe
+	struct SetOperation
+	{
+		SetOperation(ThreadPool& inPool, int size) :pool(inPool), grain(BinTree<T>::parallelGrain(size, inPool)) {}
+
+		void discard(BinNode<T>* node)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			discarded.push_back(node);
+		}
+
+		ThreadPool& pool;
+		int grain;
+		std::mutex mutex;
+		Vector<BinNode<T>*> discarded;  // Roots of removed subtrees
+	};
+
+	// Take the root of other, the arena is merged or copied
+	BinNode<T>* takeNodes(BinarySearchTree& other);
+	// Set the root after join and split, and update the states depend on it
+	void setJoinedRoot(BinNode<T>* root);
+	void finishSetOperation(BinNode<T>* root, SetOperation& operation);
+
+	BinNode<T>* unionNodes(BinNode<T>* a, BinNode<T>* b, SetOperation& operation, int depth);
+	BinNode<T>* intersectNodes(BinNode<T>* a, BinNode<T>* b, SetOperation& operation, int depth);
+	BinNode<T>* differenceNodes(BinNode<T>* a, BinNode<T>* b, SetOperation& operation, int depth);
+	// Run the two functions, in parallel if the subtrees are big enough
+	template<typename LEFT, typename RIGHT> static void forkJoin(SetOperation& operation, bool isBig, LEFT left, RIGHT right);
+	// Cut the children from node
+	static void detachChildren(BinNode<T>* node, BinNode<T>*& l, BinNode<T>*& r);
+
+	// Create the filter with capacity for twice of current size, then add all keys
+	void rebuildSearchFilter();
+
+	template<typename Hash>
+	static unsigned long long hashForSearchFilter(const T& val)
+	{
+		unsigned long long h = static_cast<unsigned long long>(Hash()(val)) * 0x9E3779B97F4A7C15ull;
+		return h ^ (h >> 29);
+	}
+
+	static const int MinSearchFilterCapacity = 1024;
+
+	BlockedBloomFilter* searchFilter = nullptr;
+	unsigned long long (*searchFilterHash)(const T& val) = nullptr;
+	double searchFilterFalsePositiveRate = 0;
+	size_t searchFilterMemoryBudget = 0;
+	int erasedSinceRebuild = 0;
+	bool isSearchFilterStale = false;
+	SearchFilterStats searchFilterStats = SearchFilterStats();
 };
 
+template<typename T>
+template<bool Reverse>
+class BinarySearchTree<T>::TreeIterator
+{
+	friend class BinarySearchTree<T>;
+public:
+	typedef std::bidirectional_iterator_tag iterator_category;
+	typedef T value_type;
+	typedef int difference_type;
+	typedef const T* pointer;
+	typedef const T& reference;
+
+	TreeIterator() :tree(nullptr), node(nullptr) {}
+
+	// Keys can't be changed by iterator, it breaks the order
+	const T& operator*() const
+	{
+		assert(node);
+		return node->data;
+	}
+	const T* operator->() const { return &**this; }
+	BinNode<T>* getNode() const { return node; }
+
+	TreeIterator& operator++()
+	{
+		assert(node);  // Can not increase at end()
+		node = Reverse ? node->pred() : node->succ();
+		return *this;
+	}
+	TreeIterator operator++(int)
+	{
+		TreeIterator ret = *this;
+		++*this;
+		return ret;
+	}
+	TreeIterator& operator--()
+	{
+		// end() goes to the last one
+		if (!node) node = Reverse ? leftmost(tree->_root) : rightmost(tree->_root);
+		else node = Reverse ? node->succ() : node->pred();
+		return *this;
+	}
+	TreeIterator operator--(int)
+	{
+		TreeIterator ret = *this;
+		--*this;
+		return ret;
+	}
+	bool operator==(const TreeIterator& rhs) const { return node == rhs.node; }
+	bool operator!=(const TreeIterator& rhs) const { return !(*this == rhs); }
+
+private:
+	TreeIterator(const BinarySearchTree<T>* inTree, BinNode<T>* inNode) :tree(inTree), node(inNode) {}
+
+	const BinarySearchTree<T>* tree;
+	BinNode<T>* node;
+};
+
+template<typename T>
+typename BinarySearchTree<T>::Iterator BinarySearchTree<T>::lower_bound(const T& val) const
+{
+	BinNode<T>* ret = nullptr;
+	BinNode<T>* node = this->_root;
+	while (node)
+	{
+		if (node->data < val)
+		{
+			node = node->rChild;
+		}
+		else
+		{
+			ret = node;
+			node = node->lChild;
+		}
+	}
+	return Iterator(this, ret);
+}
+
+template<typename T>
+typename BinarySearchTree<T>::Iterator BinarySearchTree<T>::upper_bound(const T& val) const
+{
+	BinNode<T>* ret = nullptr;
+	BinNode<T>* node = this->_root;
+	while (node)
+	{
+		if (val < node->data)
+		{
+			ret = node;
+			node = node->lChild;
+		}
+		else
+		{
+			node = node->rChild;
+		}
+	}
+	return Iterator(this, ret);
+}
+
 template<typename T>
 BinNode<T>* BinarySearchTree<T>::search(const T & val)
 {
+	if (searchFilter)
+	{
+		if (isSearchFilterStale) rebuildSearchFilter();
+		if (!searchFilter->mayContain(searchFilterHash(val)))
+		{
+			++searchFilterStats.hits;
+			_hot = nullptr;
+			return nullptr;
+		}
+		++searchFilterStats.misses;
+		BinNode<T>* ret = searchIn(this->root(), val);
+		if (!ret) ++searchFilterStats.falsePositives;
+		return ret;
+	}
 	return searchIn(this->root(), val);
 }
 
@@ -61,22 +361,29 @@ BinNode<T>* BinarySearchTree<T>::searchIn(BinNode<T>* r, const T & val)
 template<typename T>
 BinNode<T>* BinarySearchTree<T>::insert(const T & val)
 {
-	if (this->empty()) this->insertAsRoot(val);
+	if (this->empty())
+	{
+		this->insertAsRoot(val);
+		addToSearchFilter(val);
+	}
 
-	BinNode<T>* pos = search(val);
+	// Insert need _hot, don't let the filter answer it
+	BinNode<T>* pos = searchIn(this->root(), val);
 	BinNode<T>* ret = nullptr;
 	if (!pos)
 	{
 		if (val > _hot->getData())
 		{
-			ret = _hot->insertAsRChild(new BinNode<T>(val));
+			ret = _hot->insertAsRChild(this->createNode(val));
 		}
 		else
 		{
-			ret = _hot->insertAsLChild(new BinNode<T>(val));
+			ret = _hot->insertAsLChild(this->createNode(val));
 		}
+		this->threadInserted(ret);
 		++(this->_size);
 		this->updateHeightAbove(ret);
+		addToSearchFilter(val);
 		return ret;
 	}
 	else
@@ -94,6 +401,7 @@ bool BinarySearchTree<T>::erase(const T& val)
 		eraseAt(pos);
 		--(this->_size);
 		this->updateHeightAbove(_hot);
+		onErasedForSearchFilter();
 		return true;
 	}
 	else
@@ -102,10 +410,110 @@ bool BinarySearchTree<T>::erase(const T& val)
 	}
 }
 
+template<typename T>
+BinNode<T>* BinarySearchTree<T>::select(int k) const
+{
+	if (k < 0 || k >= this->_size) return nullptr;
+	BinNode<T>* node = this->_root;
+	while (node)
+	{
+		int leftSize = subtreeSize(node->lChild);
+		if (k < leftSize)
+		{
+			node = node->lChild;
+		}
+		else if (k > leftSize)
+		{
+			k -= leftSize + 1;
+			node = node->rChild;
+		}
+		else
+		{
+			return node;
+		}
+	}
+	return nullptr;
+}
+
+template<typename T>
+int BinarySearchTree<T>::rank(const T& val) const
+{
+	int ret = 0;
+	BinNode<T>* node = this->_root;
+	while (node)
+	{
+		if (node->data < val)
+		{
+			ret += subtreeSize(node->lChild) + 1;
+			node = node->rChild;
+		}
+		else
+		{
+			node = node->lChild;
+		}
+	}
+	return ret;
+}
+
+template<typename T>
+typename BinNode<T>::Augmentation::Value BinarySearchTree<T>::aggregate(const T& lo, const T& hi) const
+{
+	typedef typename BinNode<T>::Augmentation Policy;
+	typedef typename Policy::Value Value;
+	if (!(lo < hi)) return Policy::identity();
+
+	// Find the highest node in range, the paths to lo and hi split at it
+	BinNode<T>* top = this->_root;
+	while (top)
+	{
+		if (top->data < lo) top = top->rChild;
+		else if (!(top->data < hi)) top = top->lChild;
+		else break;
+	}
+	if (!top) return Policy::identity();
+
+	// Keys >= lo in left subtree, a node in range comes with its right subtree
+	Value left = Policy::identity();
+	for (BinNode<T>* p = top->lChild; p;)
+	{
+		if (p->data < lo)
+		{
+			p = p->rChild;
+		}
+		else
+		{
+			Value v = Policy::lift(p->data);
+			if (p->rChild) v = Policy::combine(v, p->rChild->_aggregate);
+			left = Policy::combine(v, left);
+			p = p->lChild;
+		}
+	}
+
+	// Keys < hi in right subtree, a node in range comes with its left subtree
+	Value right = Policy::identity();
+	for (BinNode<T>* p = top->rChild; p;)
+	{
+		if (p->data < hi)
+		{
+			Value v = Policy::lift(p->data);
+			if (p->lChild) v = Policy::combine(p->lChild->_aggregate, v);
+			right = Policy::combine(right, v);
+			p = p->rChild;
+		}
+		else
+		{
+			p = p->lChild;
+		}
+	}
+
+	return Policy::combine(Policy::combine(left, Policy::lift(top->data)), right);
+}
+
 template<typename T>
 inline BinNode<T>* BinarySearchTree<T>::eraseAt(BinNode<T>* pos)
 {
 	BinNode<T>* swapNode;
+	this->unthreadNode(pos);
 
 	if (!pos->hasRChild())
 	{
@@ -132,7 +540,8 @@ inline BinNode<T>* BinarySearchTree<T>::eraseAt(BinNode<T>* pos)
 	}
 
 	_hot = pos->parent;
-	delete pos;
+	this->destroyNode(pos);
+	this->updateSubtreeAbove(_hot);  // Rebalancing after erase need the right sizes and aggregates
 
 	return swapNode;
 }
@@ -214,6 +623,8 @@ inline void BinarySearchTree<T>::swap(BinNode<T>*& val1, BinNode<T>*& val2)
 	BinNode<T>* tempLChild = val2->lChild;
 	BinNode<T>* tempRChild = val2->rChild;
 	int tempHeight = val2->_height;
+	int tempSize = val2->_size;
+	RBColor tempColor = val2->_color;
 
 	this->fromParentTo(val1) = val2;
 	this->fromParentTo(val2) = val1;
@@ -238,4 +649,457 @@ inline void BinarySearchTree<T>::swap(BinNode<T>*& val1, BinNode<T>*& val2)
 
 	val2->_height = val1->_height;
 	val1->_height = tempHeight;
-}
\ No newline at end of file
+	val2->_size = val1->_size;
+	val1->_size = tempSize;
+	val2->_color = val1->_color;
+	val1->_color = tempColor;
+}
+
+template<typename T>
+BinNode<T>* BinarySearchTree<T>::joinNodes(BinNode<T>* l, BinNode<T>* k, BinNode<T>* r)
+{
+	k->parent = nullptr;
+	k->lChild = nullptr;
+	k->rChild = nullptr;
+	if (l) k->insertAsLChild(l);
+	if (r) k->insertAsRChild(r);
+	this->updateHeight(k);
+	return k;
+}
+
+template<typename T>
+BinNode<T>* BinarySearchTree<T>::joinNodes(BinNode<T>* l, BinNode<T>* r)
+{
+	if (!l) return r;
+	if (!r) return l;
+	// Take the last node of l as the middle one
+	BinNode<T>* last = rightmost(l);
+	BinNode<T>* rest;
+	BinNode<T>* empty;
+	splitNodes(l, last->data, rest, empty);
+	return joinNodes(rest, last, r);
+}
+
+template<typename T>
+BinNode<T>* BinarySearchTree<T>::splitNodes(BinNode<T>* t, const T& key, BinNode<T>*& l, BinNode<T>*& r)
+{
+	// Walk down to key, then join the path back from the bottom.
+	// The nodes we go right from are less than key, they are joined to l with their left subtrees, others to r.
+	Stack<BinNode<T>*> path;
+	BinNode<T>* found = nullptr;
+	while (t)
+	{
+		if (key < t->data)
+		{
+			path.push(t);
+			t = t->lChild;
+		}
+		else if (t->data < key)
+		{
+			path.push(t);
+			t = t->rChild;
+		}
+		else
+		{
+			found = t;
+			break;
+		}
+	}
+
+	l = r = nullptr;
+	if (found)
+	{
+		detachChildren(found, l, r);
+		found->parent = nullptr;
+	}
+	while (!path.empty())
+	{
+		// The child on the path is already in l or r and may have a new parent, only take the other one
+		BinNode<T>* p = path.top();
+		path.pop();
+		if (key < p->data)
+		{
+			BinNode<T>* pr = p->rChild;
+			if (pr) pr->parent = nullptr;
+			r = joinNodes(r, p, pr);
+		}
+		else
+		{
+			BinNode<T>* pl = p->lChild;
+			if (pl) pl->parent = nullptr;
+			l = joinNodes(pl, p, l);
+		}
+	}
+	return found;
+}
+
+template<typename T>
+inline void BinarySearchTree<T>::detachChildren(BinNode<T>* node, BinNode<T>*& l, BinNode<T>*& r)
+{
+	l = node->lChild;
+	r = node->rChild;
+	if (l) l->parent = nullptr;
+	if (r) r->parent = nullptr;
+	node->lChild = nullptr;
+	node->rChild = nullptr;
+}
+
+template<typename T>
+BinNode<T>* BinarySearchTree<T>::takeNodes(BinarySearchTree& other)
+{
+	assert(&other != this);
+	assert(typeid(other) == typeid(*this));  // The height means different in AVLTree and RedBlackTree
+	const int size = this->_size;
+	BinNode<T>* ret = this->adoptTree(other);
+	this->_size = size;
+	if (other.searchFilter) other.isSearchFilterStale = true;
+	return ret;
+}
+
+template<typename T>
+void BinarySearchTree<T>::setJoinedRoot(BinNode<T>* root)
+{
+	if (root)
+	{
+		root->parent = nullptr;
+		settleRoot(root);
+		this->threadSubtree(root);  // Links inside the parts are kept, only the ends of them change
+	}
+	this->_root = root;
+	this->_size = subtreeSize(root);
+	_hot = nullptr;
+	if (searchFilter) isSearchFilterStale = true;
+}
+
+template<typename T>
+void BinarySearchTree<T>::join(const T& key, BinarySearchTree& right)
+{
+	BinNode<T>* r = takeNodes(right);
+	BinNode<T>* l = this->_root;
+	this->_root = nullptr;
+	assert(!l || rightmost(l)->data < key);
+	assert(!r || key < leftmost(r)->data);
+
+	BinNode<T>* k = this->createNode(key);
+	setJoinedRoot(joinNodes(l, k, r));
+	this->threadInserted(k);
+}
+
+template<typename T>
+void BinarySearchTree<T>::join(BinarySearchTree& right)
+{
+	BinNode<T>* r = takeNodes(right);
+	BinNode<T>* l = this->_root;
+	this->_root = nullptr;
+	assert(!l || !r || rightmost(l)->data < leftmost(r)->data);
+	if (!l || !r)
+	{
+		setJoinedRoot(l ? l : r);
+		return;
+	}
+
+	// The first node of right is the middle one
+	BinNode<T>* k = leftmost(r);
+	BinNode<T>* empty;
+	BinNode<T>* rest;
+	splitNodes(r, k->data, empty, rest);
+	setJoinedRoot(joinNodes(l, k, rest));
+	this->threadInserted(k);
+}
+
+template<typename T>
+void BinarySearchTree<T>::split(const T& key, BinarySearchTree& right)
+{
+	assert(&right != this && right.empty());
+	assert(typeid(right) == typeid(*this));
+	BinNode<T>* l;
+	BinNode<T>* r;
+	BinNode<T>* root = this->_root;
+	this->_root = nullptr;
+	if (root)
+	{
+		BinNode<T>* found = splitNodes(root, key, l, r);
+		if (found) r = joinNodes(nullptr, found, r);
+	}
+	else l = r = nullptr;
+
+	right.shareArenaOf(*this);
+	setJoinedRoot(l);
+	right.setJoinedRoot(r);
+}
+
+template<typename T>
+template<typename LEFT, typename RIGHT>
+inline void BinarySearchTree<T>::forkJoin(SetOperation& operation, bool isBig, LEFT left, RIGHT right)
+{
+	if (!isBig)
+	{
+		left();
+		right();
+		return;
+	}
+	ThreadPool::TaskGroup group(operation.pool);
+	group.run(left);
+	right();
+	group.wait();
+}
+
+template<typename T>
+BinNode<T>* BinarySearchTree<T>::unionNodes(BinNode<T>* a, BinNode<T>* b, SetOperation& operation, int depth)
+{
+	if (!a) return b;
+	if (!b) return a;
+
+	// Split b by the root of a, then unite the two sides
+	const bool isBig = depth > 0 && subtreeSize(a) + subtreeSize(b) >= operation.grain;
+	BinNode<T>* al;
+	BinNode<T>* ar;
+	BinNode<T>* bl;
+	BinNode<T>* br;
+	detachChildren(a, al, ar);
+	BinNode<T>* same = splitNodes(b, a->data, bl, br);
+	if (same) operation.discard(same);
+
+	BinNode<T>* l;
+	BinNode<T>* r;
+	forkJoin(operation, isBig,
+		[&]() { l = unionNodes(al, bl, operation, depth - 1); },
+		[&]() { r = unionNodes(ar, br, operation, depth - 1); });
+	return joinNodes(l, a, r);
+}
+
+template<typename T>
+BinNode<T>* BinarySearchTree<T>::intersectNodes(BinNode<T>* a, BinNode<T>* b, SetOperation& operation, int depth)
+{
+	if (!a || !b)
+	{
+		if (a) operation.discard(a);
+		if (b) operation.discard(b);
+		return nullptr;
+	}
+
+	const bool isBig = depth > 0 && subtreeSize(a) + subtreeSize(b) >= operation.grain;
+	BinNode<T>* al;
+	BinNode<T>* ar;
+	BinNode<T>* bl;
+	BinNode<T>* br;
+	detachChildren(a, al, ar);
+	BinNode<T>* same = splitNodes(b, a->data, bl, br);
+
+	BinNode<T>* l;
+	BinNode<T>* r;
+	forkJoin(operation, isBig,
+		[&]() { l = intersectNodes(al, bl, operation, depth - 1); },
+		[&]() { r = intersectNodes(ar, br, operation, depth - 1); });
+	if (same)
+	{
+		operation.discard(same);
+		return joinNodes(l, a, r);
+	}
+	operation.discard(a);
+	return joinNodes(l, r);
+}
+
+template<typename T>
+BinNode<T>* BinarySearchTree<T>::differenceNodes(BinNode<T>* a, BinNode<T>* b, SetOperation& operation, int depth)
+{
+	if (!a || !b)
+	{
+		if (b) operation.discard(b);
+		return a;
+	}
+
+	// Split a by the root of b, the root of b and the same node in a are removed
+	const bool isBig = depth > 0 && subtreeSize(a) + subtreeSize(b) >= operation.grain;
+	BinNode<T>* al;
+	BinNode<T>* ar;
+	BinNode<T>* bl;
+	BinNode<T>* br;
+	detachChildren(b, bl, br);
+	BinNode<T>* same = splitNodes(a, b->data, al, ar);
+	if (same) operation.discard(same);
+	operation.discard(b);
+
+	BinNode<T>* l;
+	BinNode<T>* r;
+	forkJoin(operation, isBig,
+		[&]() { l = differenceNodes(al, bl, operation, depth - 1); },
+		[&]() { r = differenceNodes(ar, br, operation, depth - 1); });
+	return joinNodes(l, r);
+}
+
+template<typename T>
+void BinarySearchTree<T>::finishSetOperation(BinNode<T>* root, SetOperation& operation)
+{
+	for (unsigned i = 0; i < operation.discarded.size(); ++i)
+	{
+		BinTree<T>::destroySubtree(operation.discarded[i], [this](BinNode<T>* node) { this->destroyNode(node); });
+	}
+	if (root)
+	{
+		root->parent = nullptr;
+		settleRoot(root);
+		this->threadDetached(root);
+	}
+	this->_root = root;
+	this->_size = subtreeSize(root);
+	_hot = nullptr;
+	if (searchFilter) isSearchFilterStale = true;
+}
+
+template<typename T>
+void BinarySearchTree<T>::unionWith(BinarySearchTree& other, ThreadPool& pool)
+{
+	BinNode<T>* b = takeNodes(other);
+	BinNode<T>* a = this->_root;
+	this->_root = nullptr;
+	SetOperation operation(pool, subtreeSize(a) + subtreeSize(b));
+	const int depth = pool.threadCount() > 1 ? BinTree<T>::parallelDepth(pool) : 0;
+	finishSetOperation(unionNodes(a, b, operation, depth), operation);
+}
+
+template<typename T>
+void BinarySearchTree<T>::intersectWith(BinarySearchTree& other, ThreadPool& pool)
+{
+	BinNode<T>* b = takeNodes(other);
+	BinNode<T>* a = this->_root;
+	this->_root = nullptr;
+	SetOperation operation(pool, subtreeSize(a) + subtreeSize(b));
+	const int depth = pool.threadCount() > 1 ? BinTree<T>::parallelDepth(pool) : 0;
+	finishSetOperation(intersectNodes(a, b, operation, depth), operation);
+}
+
+template<typename T>
+void BinarySearchTree<T>::difference(BinarySearchTree& other, ThreadPool& pool)
+{
+	BinNode<T>* b = takeNodes(other);
+	BinNode<T>* a = this->_root;
+	this->_root = nullptr;
+	SetOperation operation(pool, subtreeSize(a) + subtreeSize(b));
+	const int depth = pool.threadCount() > 1 ? BinTree<T>::parallelDepth(pool) : 0;
+	finishSetOperation(differenceNodes(a, b, operation, depth), operation);
+}
+
+template<typename T>
+template<typename Iter>
+void BinarySearchTree<T>::buildFromSorted(Iter b, Iter e, bool parallel, ThreadPool& pool)
+{
+	// Start from empty slabs, so the new nodes are not put in the holes of old ones
+	this->remove(this->_root);
+	if (!this->isArenaShared()) this->arena->releaseAll();
+	_hot = nullptr;
+
+	const int n = static_cast<int>(e - b);
+	if (n == 0) return;
+
+	// The tree of middle splits has every level full except the deepest one, its depth is floor(log2(n)).
+	// Making only that level red keeps the black height same on all paths. The root is black.
+	int redDepth = 0;
+	while ((2 << redDepth) <= n) ++redDepth;
+	if (redDepth == 0) redDepth = -1;
+
+	if (parallel && pool.threadCount() > 1)
+	{
+		const int grain = BinTree<T>::parallelGrain(n, pool);
+		this->_root = buildSubtree(b, e, 0, redDepth, *this->arena, pool, grain, std::integral_constant<bool, Arena::CanMerge>());
+	}
+	else
+	{
+		this->_root = buildSubtree(b, e, 0, redDepth, *this->arena);
+	}
+	this->_size = n;
+	this->threadDetached(this->_root);
+	if (searchFilter) isSearchFilterStale = true;
+}
+
+template<typename T>
+template<typename Iter>
+BinNode<T>* BinarySearchTree<T>::buildSubtree(Iter b, Iter e, int depth, int redDepth, Arena& arena)
+{
+	if (b == e) return nullptr;
+	Iter mid = b + (e - b) / 2;
+	// Left subtree first, so the nodes are in inorder in memory
+	BinNode<T>* lc = buildSubtree(b, mid, depth + 1, redDepth, arena);
+	BinNode<T>* node = new (arena.allocate()) BinNode<T>(*mid);
+	BinNode<T>* rc = buildSubtree(mid + 1, e, depth + 1, redDepth, arena);
+	return linkBuilt(node, lc, rc, depth, redDepth);
+}
+
+template<typename T>
+template<typename Iter>
+BinNode<T>* BinarySearchTree<T>::buildSubtree(Iter b, Iter e, int depth, int redDepth, Arena& arena, ThreadPool& pool, int grain, std::true_type canMerge)
+{
+	if (e - b < grain) return buildSubtree(b, e, depth, redDepth, arena);
+	Iter mid = b + (e - b) / 2;
+
+	// The arena is not thread safe, the left half is built by another task in a new arena
+	Arena* leftArena = new Arena(sizeof(BinNode<T>));
+	BinNode<T>* lc = nullptr;
+	ThreadPool::TaskGroup group(pool);
+	group.run([&]() { lc = buildSubtree(b, mid, depth + 1, redDepth, *leftArena, pool, grain, canMerge); });
+	BinNode<T>* node = new (arena.allocate()) BinNode<T>(*mid);
+	BinNode<T>* rc = buildSubtree(mid + 1, e, depth + 1, redDepth, arena, pool, grain, canMerge);
+	group.wait();
+	arena.merge(*leftArena);
+	delete leftArena;
+	return linkBuilt(node, lc, rc, depth, redDepth);
+}
+
+template<typename T>
+BinNode<T>* BinarySearchTree<T>::linkBuilt(BinNode<T>* node, BinNode<T>* lc, BinNode<T>* rc, int depth, int redDepth)
+{
+	if (lc) node->insertAsLChild(lc);
+	if (rc) node->insertAsRChild(rc);
+	node->_color = depth == redDepth ? RED : BLACK;
+	this->updateHeight(node);  // RedBlackTree count the black height by the color
+	return node;
+}
+
+template<typename T>
+template<typename Hash>
+void BinarySearchTree<T>::enableSearchFilter(double falsePositiveRate, size_t memoryBudget)
+{
+	searchFilterHash = &hashForSearchFilter<Hash>;
+	searchFilterFalsePositiveRate = falsePositiveRate;
+	searchFilterMemoryBudget = memoryBudget;
+	rebuildSearchFilter();
+}
+
+template<typename T>
+void BinarySearchTree<T>::disableSearchFilter()
+{
+	delete searchFilter;
+	searchFilter = nullptr;
+	isSearchFilterStale = false;
+}
+
+template<typename T>
+void BinarySearchTree<T>::rebuildSearchFilter()
+{
+	size_t capacity = this->_size * 2 > MinSearchFilterCapacity ? this->_size * 2 : MinSearchFilterCapacity;
+	delete searchFilter;
+	searchFilter = new BlockedBloomFilter(capacity, searchFilterFalsePositiveRate, searchFilterMemoryBudget);
+	this->traversalInorder([this](const T& val) { searchFilter->add(searchFilterHash(val)); });
+
+	erasedSinceRebuild = 0;
+	isSearchFilterStale = false;
+	++searchFilterStats.rebuilds;
+}
+
+template<typename T>
+inline void BinarySearchTree<T>::addToSearchFilter(const T& val)
+{
+	if (!searchFilter) return;
+	searchFilter->add(searchFilterHash(val));
+	if (static_cast<size_t>(this->_size) > searchFilter->capacity()) isSearchFilterStale = true;
+}
+
+template<typename T>
+inline void BinarySearchTree<T>::onErasedForSearchFilter()
+{
+	// Bits of erased keys stay in the filter and only make false positive.
+	// Rebuild when they are a quarter of the keys.
+	if (!searchFilter) return;
+	++erasedSinceRebuild;
+	if (erasedSinceRebuild * 4 > this->_size + erasedSinceRebuild) isSearchFilterStale = true;
+}
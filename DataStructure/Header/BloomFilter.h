@@ -0,0 +1,110 @@
+#pragma once
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Cache line blocked Bloom filter. All bits of a key are in one 64 bytes block, so a lookup touch only one cache line.
+// Keys are given as 64 bits hash, which should be well mixed.
+class BlockedBloomFilter
+{
+public:
+	// --------------------
+	// Constructor and destructor
+	// --------------------
+
+	// The false positive rate is about falsePositiveRate until capacity keys are added.
+	// memoryBudget limits the bytes of bits if it's not 0, the false positive rate is higher if the budget is not enough.
+	BlockedBloomFilter(size_t inCapacity, double falsePositiveRate, size_t memoryBudget = 0);
+	~BlockedBloomFilter() { delete[] buffer; }
+
+	BlockedBloomFilter(const BlockedBloomFilter&) = delete;
+	BlockedBloomFilter& operator=(const BlockedBloomFilter&) = delete;
+
+	// --------------------
+	// Member operator
+	// --------------------
+
+	void add(unsigned long long hash);
+	bool mayContain(unsigned long long hash) const;
+	void clear() { memset(blocks, 0, blockCount * sizeof(Block)); }
+
+	size_t capacity() const { return _capacity; }
+	size_t memorySize() const { return blockCount * sizeof(Block); }
+	unsigned hashCount() const { return _hashCount; }
+
+private:
+	static const unsigned BlockBits = 512;
+	static const unsigned MaxHashCount = 16;
+
+	struct Block
+	{
+		unsigned long long words[BlockBits / 64];
+	};
+
+	size_t blockIndex(unsigned long long hash) const
+	{
+		// Map the high bits to [0, blockCount) without division
+		return static_cast<size_t>(((hash >> 32) * blockCount) >> 32);
+	}
+
+	char* buffer;  // blocks aligned to cache line in it
+	Block* blocks;
+	size_t blockCount;
+	size_t _capacity;
+	unsigned _hashCount;
+};
+
+inline BlockedBloomFilter::BlockedBloomFilter(size_t inCapacity, double falsePositiveRate, size_t memoryBudget)
+	:_capacity(inCapacity ? inCapacity : 1)
+{
+	assert(falsePositiveRate > 0 && falsePositiveRate < 1);
+
+	// Optimal bits per key is -ln(p) / ln(2)^2, and ln(2) * bits per key of hash functions
+	const double ln2 = 0.69314718055994530942;
+	double bitsPerKey = -std::log(falsePositiveRate) / (ln2 * ln2);
+	double bits = bitsPerKey * _capacity;
+	if (memoryBudget && bits > memoryBudget * 8.0) bits = memoryBudget * 8.0;
+
+	blockCount = static_cast<size_t>(bits / BlockBits) + 1;
+	if (blockCount > 0xffffffffu) blockCount = 0xffffffffu;
+	bitsPerKey = static_cast<double>(blockCount) * BlockBits / _capacity;
+
+	_hashCount = static_cast<unsigned>(bitsPerKey * ln2 + 0.5);
+	if (_hashCount < 1) _hashCount = 1;
+	if (_hashCount > MaxHashCount) _hashCount = MaxHashCount;
+
+	const size_t cacheLine = sizeof(Block);
+	buffer = new char[blockCount * sizeof(Block) + cacheLine];
+	blocks = reinterpret_cast<Block*>((reinterpret_cast<uintptr_t>(buffer) + cacheLine - 1) & ~(uintptr_t)(cacheLine - 1));
+	clear();
+}
+
+inline void BlockedBloomFilter::add(unsigned long long hash)
+{
+	Block& block = blocks[blockIndex(hash)];
+	// Double hashing in the block, the step is odd so bits don't repeat early
+	unsigned bit = static_cast<unsigned>(hash);
+	const unsigned step = static_cast<unsigned>(hash >> 23) | 1;
+	for (unsigned i = 0; i < _hashCount; ++i)
+	{
+		unsigned b = bit % BlockBits;
+		block.words[b / 64] |= 1ull << (b % 64);
+		bit += step;
+	}
+}
+
+inline bool BlockedBloomFilter::mayContain(unsigned long long hash) const
+{
+	const Block& block = blocks[blockIndex(hash)];
+	unsigned bit = static_cast<unsigned>(hash);
+	const unsigned step = static_cast<unsigned>(hash >> 23) | 1;
+	for (unsigned i = 0; i < _hashCount; ++i)
+	{
+		unsigned b = bit % BlockBits;
+		if (!(block.words[b / 64] & (1ull << (b % 64)))) return false;
+		bit += step;
+	}
+	return true;
+}
@@ -1,16 +1,274 @@
 #pragma once
 #include <cassert>
+#include <cstddef>
+#include <type_traits>
 #include <utility>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SORT_NETWORK_SSE2
+#endif
+
+// --------------------
+// Sorting network for small arrays, the comparators are fixed at compile time and don't depend on data.
+// --------------------
+
+const unsigned MaxSortNetworkSize = 32;
+
+struct SortComparator
+{
+	unsigned first, second;
+};
+
+template<unsigned Count>
+struct SortComparatorTable
+{
+	SortComparator comparators[Count == 0 ? 1 : Count];
+};
+
+// Batcher's odd-even merge sort of n elements, out can be nullptr to count the comparators only.
+constexpr unsigned batcherSortNetwork(unsigned n, SortComparator* out)
+{
+	unsigned count = 0;
+	for (unsigned p = 1; p < n; p *= 2)
+	{
+		for (unsigned k = p; k >= 1; k /= 2)
+		{
+			for (unsigned j = k % p; j + k < n; j += 2 * k)
+			{
+				for (unsigned i = 0; i < k && i + j + k < n; ++i)
+				{
+					if ((i + j) / (p * 2) != (i + j + k) / (p * 2)) continue;
+					if (out) out[count] = SortComparator{ i + j, i + j + k };
+					++count;
+				}
+			}
+		}
+	}
+	return count;
+}
+
+// Batcher's network is used if there is no better one
+template<unsigned N>
+struct SortNetwork
+{
+	static constexpr unsigned Count = batcherSortNetwork(N, nullptr);
+	static constexpr SortComparatorTable<Count> table()
+	{
+		SortComparatorTable<Count> t = {};
+		batcherSortNetwork(N, t.comparators);
+		return t;
+	}
+};
+
+// Optimal networks of up to 8 elements and the best known one of 16 elements
+template<>
+struct SortNetwork<3>
+{
+	static constexpr unsigned Count = 3;
+	static constexpr SortComparatorTable<Count> table()
+	{
+		return{ { { 0,2 },{ 0,1 },{ 1,2 } } };
+	}
+};
+
+template<>
+struct SortNetwork<4>
+{
+	static constexpr unsigned Count = 5;
+	static constexpr SortComparatorTable<Count> table()
+	{
+		return{ { { 0,1 },{ 2,3 },{ 0,2 },{ 1,3 },{ 1,2 } } };
+	}
+};
+
+template<>
+struct SortNetwork<5>
+{
+	static constexpr unsigned Count = 9;
+	static constexpr SortComparatorTable<Count> table()
+	{
+		return{ { { 0,1 },{ 3,4 },{ 2,4 },{ 2,3 },{ 1,4 },{ 0,3 },{ 0,2 },{ 1,3 },{ 1,2 } } };
+	}
+};
+
+template<>
+struct SortNetwork<6>
+{
+	static constexpr unsigned Count = 12;
+	static constexpr SortComparatorTable<Count> table()
+	{
+		return{ { { 1,2 },{ 4,5 },{ 0,2 },{ 3,5 },{ 0,1 },{ 3,4 },{ 2,5 },{ 0,3 },{ 1,4 },{ 2,4 },{ 1,3 },{ 2,3 } } };
+	}
+};
+
+template<>
+struct SortNetwork<7>
+{
+	static constexpr unsigned Count = 16;
+	static constexpr SortComparatorTable<Count> table()
+	{
+		return{ { { 1,2 },{ 3,4 },{ 5,6 },{ 0,2 },{ 3,5 },{ 4,6 },{ 0,1 },{ 4,5 },
+			{ 2,6 },{ 0,4 },{ 1,5 },{ 0,3 },{ 2,5 },{ 1,3 },{ 2,4 },{ 2,3 } } };
+	}
+};
+
+template<>
+struct SortNetwork<8>
+{
+	static constexpr unsigned Count = 19;
+	static constexpr SortComparatorTable<Count> table()
+	{
+		return{ { { 0,2 },{ 1,3 },{ 4,6 },{ 5,7 },{ 0,4 },{ 1,5 },{ 2,6 },{ 3,7 },{ 0,1 },{ 2,3 },
+			{ 4,5 },{ 6,7 },{ 2,4 },{ 3,5 },{ 1,4 },{ 3,6 },{ 1,2 },{ 3,4 },{ 5,6 } } };
+	}
+};
+
+template<>
+struct SortNetwork<16>
+{
+	static constexpr unsigned Count = 60;
+	static constexpr SortComparatorTable<Count> table()
+	{
+		return{ { { 0,13 },{ 1,12 },{ 2,15 },{ 3,14 },{ 4,8 },{ 5,6 },{ 7,11 },{ 9,10 },
+			{ 0,5 },{ 1,7 },{ 2,9 },{ 3,4 },{ 6,13 },{ 8,14 },{ 10,15 },{ 11,12 },
+			{ 0,1 },{ 2,3 },{ 4,5 },{ 6,8 },{ 7,9 },{ 10,11 },{ 12,13 },{ 14,15 },
+			{ 0,2 },{ 1,3 },{ 4,10 },{ 5,11 },{ 6,7 },{ 8,9 },{ 12,14 },{ 13,15 },
+			{ 1,2 },{ 3,12 },{ 4,6 },{ 5,7 },{ 8,10 },{ 9,11 },{ 13,14 },
+			{ 1,4 },{ 2,6 },{ 5,8 },{ 7,10 },{ 9,13 },{ 11,14 },
+			{ 2,4 },{ 3,6 },{ 9,12 },{ 11,13 },
+			{ 3,5 },{ 6,8 },{ 7,9 },{ 10,12 },
+			{ 3,4 },{ 5,6 },{ 7,8 },{ 9,10 },{ 11,12 },
+			{ 6,7 },{ 8,9 } } };
+	}
+};
+
+// Branchless for arithmetic types, the conditional moves are compiled to min and max.
+template<typename T>
+inline void compareExchange(T& a, T& b)
+{
+	const T lo = b < a ? b : a;
+	const T hi = b < a ? a : b;
+	a = lo;
+	b = hi;
+}
+
+// Indices are template arguments, so the table is only read at compile time, even without optimization
+template<unsigned First, unsigned Second, typename T>
+inline void compareExchangeAt(T* a)
+{
+	compareExchange(a[First], a[Second]);
+}
+
+template<unsigned N, typename T, size_t... I>
+inline void applySortNetwork(T* a, std::index_sequence<I...>)
+{
+	// Every comparator is unrolled with constant indices
+	int expand[] = { 0, (compareExchangeAt<SortNetwork<N>::table().comparators[I].first,
+		SortNetwork<N>::table().comparators[I].second>(a), 0)... };
+	(void)expand;
+	(void)a;  // No comparator for one element
+}
+
+// Not stable, equal elements may be reordered.
 template<typename T, unsigned N>
-void bubbleSort_Array(T(&a)[N])
+void sortNetwork(T(&a)[N])
+{
+	static_assert(N <= MaxSortNetworkSize, "Sorting network is only for small arrays");
+	applySortNetwork<N>(a, std::make_index_sequence<SortNetwork<N>::Count>());
+}
+
+// Compare exchange every element of two rows
+template<typename T>
+inline void compareExchangeRows(T* a, T* b, unsigned count)
+{
+	for (unsigned k = 0; k < count; ++k) compareExchange(a[k], b[k]);
+}
+
+#ifdef SORT_NETWORK_SSE2
+inline void compareExchangeRows(float* a, float* b, unsigned count)
+{
+	unsigned k = 0;
+	for (; k + 4 <= count; k += 4)
+	{
+		__m128 x = _mm_loadu_ps(a + k);
+		__m128 y = _mm_loadu_ps(b + k);
+		_mm_storeu_ps(a + k, _mm_min_ps(x, y));
+		_mm_storeu_ps(b + k, _mm_max_ps(x, y));
+	}
+	for (; k < count; ++k) compareExchange(a[k], b[k]);
+}
+
+inline void compareExchangeRows(double* a, double* b, unsigned count)
+{
+	unsigned k = 0;
+	for (; k + 2 <= count; k += 2)
+	{
+		__m128d x = _mm_loadu_pd(a + k);
+		__m128d y = _mm_loadu_pd(b + k);
+		_mm_storeu_pd(a + k, _mm_min_pd(x, y));
+		_mm_storeu_pd(b + k, _mm_max_pd(x, y));
+	}
+	for (; k < count; ++k) compareExchange(a[k], b[k]);
+}
+
+inline void compareExchangeRows(int* a, int* b, unsigned count)
+{
+	// SSE2 has no min and max of 32 bits integers, select by the compare mask
+	unsigned k = 0;
+	for (; k + 4 <= count; k += 4)
+	{
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + k));
+		__m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + k));
+		__m128i isGreater = _mm_cmpgt_epi32(x, y);
+		__m128i lo = _mm_or_si128(_mm_and_si128(isGreater, y), _mm_andnot_si128(isGreater, x));
+		__m128i hi = _mm_or_si128(_mm_and_si128(isGreater, x), _mm_andnot_si128(isGreater, y));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(a + k), lo);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(b + k), hi);
+	}
+	for (; k < count; ++k) compareExchange(a[k], b[k]);
+}
+#endif
+
+template<unsigned First, unsigned Second, typename T>
+inline void compareExchangeRowsAt(T* data, unsigned count)
+{
+	compareExchangeRows(data + First * count, data + Second * count, count);
+}
+
+template<unsigned N, typename T, size_t... I>
+inline void applySortNetworkRows(T* data, unsigned count, std::index_sequence<I...>)
+{
+	int expand[] = { 0, (compareExchangeRowsAt<SortNetwork<N>::table().comparators[I].first,
+		SortNetwork<N>::table().comparators[I].second>(data, count), 0)... };
+	(void)expand;
+	(void)data;
+	(void)count;
+}
+
+// Sort count arrays of N elements together, element i of array k is data[i * count + k].
+// A comparator works on two rows, so the arrays are sorted in SIMD lanes.
+template<typename T, unsigned N>
+void sortNetworkBatch(T* data, unsigned count)
+{
+	static_assert(std::is_arithmetic<T>::value, "Batch sorting network is for arithmetic types");
+	static_assert(N <= MaxSortNetworkSize, "Sorting network is only for small arrays");
+	applySortNetworkRows<N>(data, count, std::make_index_sequence<SortNetwork<N>::Count>());
+}
+
+// --------------------
+// Bubble sort
+// --------------------
+
+template<typename T, unsigned N>
+void bubbleSortImpl(T(&a)[N], std::false_type)
 {
 	assert(N != 0);
 	bool isDone = false;
+	unsigned n = N - 1;
 	while (!isDone)
 	{
 		isDone = true;
-		unsigned n = N - 1;
 		for (unsigned i = 0; i < n; ++i)
 		{
 			if (a[i+1] < a[i])
@@ -23,6 +281,20 @@ void bubbleSort_Array(T(&a)[N])
 	}
 }
 
+template<typename T, unsigned N>
+void bubbleSortImpl(T(&a)[N], std::true_type)
+{
+	sortNetwork(a);
+}
+
+// Small arrays of arithmetic types are sorted by sorting network, which is not stable.
+// Equal integers can't be told apart, but -0.0 and +0.0 of floating point may come out in either order.
+template<typename T, unsigned N>
+void bubbleSort_Array(T(&a)[N])
+{
+	bubbleSortImpl(a, std::integral_constant<bool, std::is_arithmetic<T>::value && N <= MaxSortNetworkSize>());
+}
+
 #include <iostream>
 
 template <typename T, unsigned N>
@@ -0,0 +1,50 @@
+#pragma once
+#include <cassert>
+
+#include "Algorithm.h"
+
+// Vector with fixed capacity, elements are stored inline so it never allocate on heap.
+// Can be used as the container of Stack, like Stack<int, FixedVector<int, 32>>.
+template<typename T, unsigned N>
+class FixedVector
+{
+public:
+	// --------------------
+	// Type declaration
+	// --------------------
+	typedef unsigned SizeType;
+	typedef unsigned Rank;
+	typedef T* VectorIterator;
+
+	// --------------------
+	// Constructor and destructor
+	// --------------------
+	FixedVector() :_size(0) {}
+
+	// --------------------
+	// Member operator
+	// --------------------
+	SizeType size() const { return _size; }
+	bool empty() const { return _size == 0; }
+	bool full() const { return _size == N; }
+	static SizeType capacity() { return N; }
+	T& operator[](Rank r) const { assert(r < _size); return _data[r]; }
+	T& front() const { return _data[0]; }
+	T& back() const { return _data[_size - 1]; }
+	VectorIterator begin() const { return _data; }
+	VectorIterator end() const { return _data + _size; }
+
+	void push_back(const T& v) { assert(_size < N); _data[_size++] = v; }
+	void pop_back() { assert(_size > 0); --_size; }
+
+	void clear() { _size = 0; }
+
+	// --------------------
+	// Algorithms
+	// --------------------
+	VectorIterator find(const T& v) const { return Algorithm::find(begin(), end(), v); }
+
+private:
+	SizeType _size;
+	mutable T _data[N];  // Keep the same interface as Vector, which return non-const element from const member
+};
@@ -0,0 +1,404 @@
+#pragma once
+#include <cassert>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HASHMAP_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Hash and equal of strings, a const char* can be used to find in HashMap<std::string, V, StringHash, StringEqual>
+// without constructing a std::string.
+struct StringHash
+{
+	size_t operator()(const char* s) const
+	{
+		// FNV-1a
+		unsigned long long h = 14695981039346656037ull;
+		for (; *s != '\0'; ++s)
+		{
+			h ^= static_cast<unsigned char>(*s);
+			h *= 1099511628211ull;
+		}
+		return static_cast<size_t>(h);
+	}
+	size_t operator()(const std::string& s) const { return (*this)(s.c_str()); }
+};
+
+struct StringEqual
+{
+	bool operator()(const std::string& a, const std::string& b) const { return a == b; }
+	bool operator()(const std::string& a, const char* b) const { return a == b; }
+};
+
+// Open addressing hash map with linear probing.
+// Every slot has a control byte, the 7 bits hash of its key or Empty. Control bytes are matched 16 at a time.
+// Erase shifts the following entries backward instead of leaving a tombstone, so a lookup always stops at the first empty slot.
+// Entries are moved when the table grows or an entry is erased, pointers to entries are invalid after that.
+template<typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>>
+class HashMap
+{
+public:
+	// --------------------
+	// Type declaration
+	// --------------------
+	typedef unsigned SizeType;
+
+	struct Entry
+	{
+		K key;
+		V value;
+	};
+
+	class Iterator;
+
+	// --------------------
+	// Constructor and destructor
+	// --------------------
+	HashMap(const Hash& inHash = Hash(), const Eq& inEqual = Eq())
+		:_size(0), _capacity(0), _control(nullptr), _entries(nullptr), hasher(inHash), equal(inEqual) {}
+	~HashMap();
+	HashMap(const HashMap& m);
+	HashMap& operator=(const HashMap& m);
+
+	// --------------------
+	// Member operator
+	// --------------------
+	SizeType size() const { return _size; }
+	bool empty() const { return _size == 0; }
+	SizeType capacity() const { return _capacity; }
+
+	Iterator begin() const;
+	Iterator end() const;
+
+	// Make sure n entries can be inserted without growing
+	void reserve(SizeType n);
+	void clear();
+	void swap(HashMap& m);
+
+	// Key can be any type that Hash and Eq accept, its hash must be the same as the equal K.
+	template<typename Key> Entry* find(const Key& key) const;
+	template<typename Key> bool contains(const Key& key) const { return find(key) != nullptr; }
+	template<typename Key> bool erase(const Key& key);
+
+	// Return the existing entry if key is already in the map
+	Entry* insert(const K& key, const V& value);
+	V& operator[](const K& key);
+
+private:
+	static const SizeType GroupWidth = 16;
+	static const SizeType MinCapacity = GroupWidth;
+	static const unsigned char Empty = 0x80;
+
+	SizeType _size;
+	SizeType _capacity;  // Power of 2
+	unsigned char* _control;  // _capacity + GroupWidth - 1 bytes, the first GroupWidth - 1 bytes are cloned at the end
+	Entry* _entries;
+	Hash hasher;
+	Eq equal;
+
+	// Scatter the bits, std::hash of integers is identity
+	template<typename Key> unsigned long long hashOf(const Key& key) const
+	{
+		unsigned long long h = static_cast<unsigned long long>(hasher(key)) * 0x9E3779B97F4A7C15ull;
+		return h ^ (h >> 32);
+	}
+	static unsigned char controlOf(unsigned long long h) { return static_cast<unsigned char>(h & 0x7f); }
+	SizeType homeOf(unsigned long long h) const { return static_cast<SizeType>(h >> 7) & (_capacity - 1); }
+
+	// Bit i is set if group[i] is c, or is Empty for matchEmpty
+	static unsigned matchGroup(const unsigned char* group, unsigned char c);
+	static unsigned matchEmpty(const unsigned char* group);
+	static unsigned lowestBit(unsigned mask);
+
+	void setControl(SizeType i, unsigned char c);
+	SizeType findEmptySlot(unsigned long long h) const;
+	void rehash(SizeType newCapacity);
+	void release();
+};
+
+// --------------------
+// Iterator, visit the entries in slot order
+// --------------------
+
+template<typename K, typename V, typename Hash, typename Eq>
+class HashMap<K, V, Hash, Eq>::Iterator
+{
+public:
+	Iterator(const HashMap* inMap, SizeType inSlot) :map(inMap), slot(inSlot) { skipEmpty(); }
+
+	Entry& operator*() const { return map->_entries[slot]; }
+	Entry* operator->() const { return map->_entries + slot; }
+	Iterator& operator++() { ++slot; skipEmpty(); return *this; }
+	bool operator==(const Iterator& it) const { return slot == it.slot; }
+	bool operator!=(const Iterator& it) const { return slot != it.slot; }
+
+private:
+	void skipEmpty() { while (slot < map->_capacity && map->_control[slot] == Empty) ++slot; }
+
+	const HashMap* map;
+	SizeType slot;
+};
+
+template<typename K, typename V, typename Hash, typename Eq>
+typename HashMap<K, V, Hash, Eq>::Iterator HashMap<K, V, Hash, Eq>::begin() const
+{
+	return Iterator(this, 0);
+}
+
+template<typename K, typename V, typename Hash, typename Eq>
+typename HashMap<K, V, Hash, Eq>::Iterator HashMap<K, V, Hash, Eq>::end() const
+{
+	return Iterator(this, _capacity);
+}
+
+// --------------------
+// Constructor and destructor
+// --------------------
+
+template<typename K, typename V, typename Hash, typename Eq>
+HashMap<K, V, Hash, Eq>::~HashMap()
+{
+	release();
+}
+
+template<typename K, typename V, typename Hash, typename Eq>
+HashMap<K, V, Hash, Eq>::HashMap(const HashMap& m)
+	:_size(0), _capacity(0), _control(nullptr), _entries(nullptr), hasher(m.hasher), equal(m.equal)
+{
+	reserve(m.size());
+	for (auto& entry : m)
+	{
+		insert(entry.key, entry.value);
+	}
+}
+
+template<typename K, typename V, typename Hash, typename Eq>
+HashMap<K, V, Hash, Eq>& HashMap<K, V, Hash, Eq>::operator=(const HashMap& m)
+{
+	if (&m == this) return *this;
+	HashMap copy(m);
+	swap(copy);
+	return *this;
+}
+
+template<typename K, typename V, typename Hash, typename Eq>
+void HashMap<K, V, Hash, Eq>::swap(HashMap& m)
+{
+	std::swap(_size, m._size);
+	std::swap(_capacity, m._capacity);
+	std::swap(_control, m._control);
+	std::swap(_entries, m._entries);
+	std::swap(hasher, m.hasher);
+	std::swap(equal, m.equal);
+}
+
+template<typename K, typename V, typename Hash, typename Eq>
+void HashMap<K, V, Hash, Eq>::release()
+{
+	for (SizeType i = 0; i < _capacity; ++i)
+	{
+		if (_control[i] != Empty) _entries[i].~Entry();
+	}
+	delete[] _control;
+	::operator delete(_entries);
+	_control = nullptr;
+	_entries = nullptr;
+	_size = _capacity = 0;
+}
+
+template<typename K, typename V, typename Hash, typename Eq>
+void HashMap<K, V, Hash, Eq>::clear()
+{
+	for (SizeType i = 0; i < _capacity; ++i)
+	{
+		if (_control[i] != Empty) _entries[i].~Entry();
+	}
+	if (_control) memset(_control, Empty, _capacity + GroupWidth - 1);
+	_size = 0;
+}
+
+// --------------------
+// Control bytes
+// --------------------
+
+template<typename K, typename V, typename Hash, typename Eq>
+inline unsigned HashMap<K, V, Hash, Eq>::matchGroup(const unsigned char* group, unsigned char c)
+{
+#ifdef HASHMAP_SSE2
+	__m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+	return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(static_cast<char>(c)))));
+#else
+	unsigned mask = 0;
+	for (unsigned i = 0; i < GroupWidth; ++i)
+	{
+		if (group[i] == c) mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+template<typename K, typename V, typename Hash, typename Eq>
+inline unsigned HashMap<K, V, Hash, Eq>::matchEmpty(const unsigned char* group)
+{
+#ifdef HASHMAP_SSE2
+	// Only Empty has the highest bit
+	return static_cast<unsigned>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(group))));
+#else
+	return matchGroup(group, Empty);
+#endif
+}
+
+template<typename K, typename V, typename Hash, typename Eq>
+inline unsigned HashMap<K, V, Hash, Eq>::lowestBit(unsigned mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+template<typename K, typename V, typename Hash, typename Eq>
+inline void HashMap<K, V, Hash, Eq>::setControl(SizeType i, unsigned char c)
+{
+	_control[i] = c;
+	// A group starting near the end reads the clone instead of wrapping around
+	if (i < GroupWidth - 1) _control[_capacity + i] = c;
+}
+
+// --------------------
+// Lookup
+// --------------------
+
+template<typename K, typename V, typename Hash, typename Eq>
+template<typename Key>
+typename HashMap<K, V, Hash, Eq>::Entry* HashMap<K, V, Hash, Eq>::find(const Key& key) const
+{
+	if (_size == 0) return nullptr;
+
+	const unsigned long long h = hashOf(key);
+	const unsigned char c = controlOf(h);
+	const SizeType mask = _capacity - 1;
+	SizeType pos = homeOf(h);
+	while (true)
+	{
+		const unsigned char* group = _control + pos;
+		for (unsigned match = matchGroup(group, c); match; match &= match - 1)
+		{
+			SizeType slot = (pos + lowestBit(match)) & mask;
+			if (equal(_entries[slot].key, key)) return _entries + slot;
+		}
+		// Linear probing never skip an empty slot, so the key is not in the map
+		if (matchEmpty(group)) return nullptr;
+		pos = (pos + GroupWidth) & mask;
+	}
+}
+
+template<typename K, typename V, typename Hash, typename Eq>
+typename HashMap<K, V, Hash, Eq>::SizeType HashMap<K, V, Hash, Eq>::findEmptySlot(unsigned long long h) const
+{
+	const SizeType mask = _capacity - 1;
+	SizeType pos = homeOf(h);
+	while (true)
+	{
+		unsigned empty = matchEmpty(_control + pos);
+		if (empty) return (pos + lowestBit(empty)) & mask;
+		pos = (pos + GroupWidth) & mask;
+	}
+}
+
+// --------------------
+// Insert and erase
+// --------------------
+
+template<typename K, typename V, typename Hash, typename Eq>
+void HashMap<K, V, Hash, Eq>::reserve(SizeType n)
+{
+	// Keep load factor under 7/8, so there is always an empty slot to stop probing
+	SizeType newCapacity = MinCapacity;
+	while (newCapacity / 8 * 7 < n) newCapacity *= 2;
+	if (newCapacity > _capacity) rehash(newCapacity);
+}
+
+template<typename K, typename V, typename Hash, typename Eq>
+void HashMap<K, V, Hash, Eq>::rehash(SizeType newCapacity)
+{
+	unsigned char* oldControl = _control;
+	Entry* oldEntries = _entries;
+	SizeType oldCapacity = _capacity;
+
+	_capacity = newCapacity;
+	_control = new unsigned char[_capacity + GroupWidth - 1];
+	memset(_control, Empty, _capacity + GroupWidth - 1);
+	_entries = static_cast<Entry*>(::operator new(sizeof(Entry) * _capacity));
+
+	for (SizeType i = 0; i < oldCapacity; ++i)
+	{
+		if (oldControl[i] == Empty) continue;
+		const unsigned long long h = hashOf(oldEntries[i].key);
+		SizeType slot = findEmptySlot(h);
+		new (_entries + slot) Entry(std::move(oldEntries[i]));
+		setControl(slot, controlOf(h));
+		oldEntries[i].~Entry();
+	}
+	delete[] oldControl;
+	::operator delete(oldEntries);
+}
+
+template<typename K, typename V, typename Hash, typename Eq>
+typename HashMap<K, V, Hash, Eq>::Entry* HashMap<K, V, Hash, Eq>::insert(const K& key, const V& value)
+{
+	Entry* entry = find(key);
+	if (entry) return entry;
+
+	reserve(_size + 1);
+	const unsigned long long h = hashOf(key);
+	SizeType slot = findEmptySlot(h);
+	new (_entries + slot) Entry{ key, value };
+	setControl(slot, controlOf(h));
+	++_size;
+	return _entries + slot;
+}
+
+template<typename K, typename V, typename Hash, typename Eq>
+V& HashMap<K, V, Hash, Eq>::operator[](const K& key)
+{
+	return insert(key, V())->value;
+}
+
+template<typename K, typename V, typename Hash, typename Eq>
+template<typename Key>
+bool HashMap<K, V, Hash, Eq>::erase(const Key& key)
+{
+	Entry* entry = find(key);
+	if (!entry) return false;
+
+	// Shift the following entries of the cluster backward if the hole is still after their home slot
+	const SizeType mask = _capacity - 1;
+	SizeType hole = static_cast<SizeType>(entry - _entries);
+	_entries[hole].~Entry();
+	for (SizeType i = (hole + 1) & mask; _control[i] != Empty; i = (i + 1) & mask)
+	{
+		SizeType home = homeOf(hashOf(_entries[i].key));
+		if (((i - home) & mask) < ((i - hole) & mask)) continue;
+
+		new (_entries + hole) Entry(std::move(_entries[i]));
+		_entries[i].~Entry();
+		setControl(hole, _control[i]);
+		hole = i;
+	}
+	setControl(hole, Empty);
+	--_size;
+	return true;
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <limits>
+#include <ostream>
+
+#include "AVLTree.h"
+
+// Closed interval [low, high], ordered by low then high
+template<typename K>
+struct Interval
+{
+	K low;
+	K high;
+
+	bool overlaps(const K& otherLow, const K& otherHigh) const { return !(high < otherLow) && !(otherHigh < low); }
+
+	bool operator==(const Interval& rhs) const { return !(low < rhs.low) && !(rhs.low < low) && !(high < rhs.high) && !(rhs.high < high); }
+	bool operator!=(const Interval& rhs) const { return !(*this == rhs); }
+	bool operator<(const Interval& rhs) const { return low < rhs.low || (!(rhs.low < low) && high < rhs.high); }
+	bool operator>(const Interval& rhs) const { return rhs < *this; }
+	bool operator<=(const Interval& rhs) const { return !(rhs < *this); }
+	bool operator>=(const Interval& rhs) const { return !(*this < rhs); }
+};
+
+// Used by BinTree::printTree
+template<typename K>
+std::ostream& operator<<(std::ostream& os, const Interval<K>& interval)
+{
+	return os << '[' << interval.low << ',' << interval.high << ']';
+}
+
+// Max high endpoint of a subtree, a subtree can be skipped if it's less than the low of query
+template<typename K>
+struct IntervalMaxEnd
+{
+	typedef K Value;
+	static K identity() { return std::numeric_limits<K>::lowest(); }
+	static K lift(const Interval<K>& data) { return data.high; }
+	static K combine(const K& lhs, const K& rhs) { return lhs < rhs ? rhs : lhs; }
+};
+
+template<typename K>
+struct BinNodeAugmentation<Interval<K>>
+{
+	typedef IntervalMaxEnd<K> type;
+};
+
+template<typename K>
+class IntervalTree : public AVLTree<Interval<K>>
+{
+public:
+
+	BinNode<Interval<K>>* insert(const K& low, const K& high) { return this->AVLTree<Interval<K>>::insert(Interval<K>{ low, high }); }
+	bool erase(const K& low, const K& high) { return this->AVLTree<Interval<K>>::erase(Interval<K>{ low, high }); }
+	using AVLTree<Interval<K>>::insert;
+	using AVLTree<Interval<K>>::erase;
+
+	// Any interval overlapping [low, high], nullptr if there is none. O(log n)
+	BinNode<Interval<K>>* findOverlap(const K& low, const K& high) const;
+
+	// Call func on every interval overlapping [low, high] in order. O(log n + number of result)
+	template<typename FUNC> void forEachOverlap(const K& low, const K& high, FUNC func) const;
+};
+
+template<typename K>
+BinNode<Interval<K>>* IntervalTree<K>::findOverlap(const K& low, const K& high) const
+{
+	BinNode<Interval<K>>* node = this->root();
+	while (node)
+	{
+		if (node->getData().overlaps(low, high)) return node;
+
+		// If the left subtree reaches low but has no overlap, all its intervals start after high, so do the right ones.
+		BinNode<Interval<K>>* lc = node->getLChild();
+		if (lc && !(lc->aggregate() < low)) node = lc;
+		else node = node->getRChild();
+	}
+	return nullptr;
+}
+
+template<typename K>
+template<typename FUNC>
+void IntervalTree<K>::forEachOverlap(const K& low, const K& high, FUNC func) const
+{
+	Stack<BinNode<Interval<K>>*> s;
+	BinNode<Interval<K>>* p = this->root();
+	while (true)
+	{
+		// Subtree ending before low is skipped
+		while (p && !(p->aggregate() < low))
+		{
+			s.push(p);
+			p = p->getLChild();
+		}
+		if (s.empty()) return;
+
+		p = s.top();
+		s.pop();
+		if (high < p->getData().low) return;  // The rest start after high
+		if (!(p->getData().high < low)) func(p->getData());
+		p = p->getRChild();
+	}
+}
@@ -0,0 +1,331 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Allocate nodes of one size from slabs, every tree owns one arena.
+// Freed nodes are kept in a free list and reused, slabs are only released all together.
+// The first slab is small, later slabs are larger so a big tree needs few of them.
+class NodeArena
+{
+public:
+	// --------------------
+	// Constructor and destructor
+	// --------------------
+
+	explicit NodeArena(size_t inNodeSize)
+		:nodeSize(roundUp(inNodeSize < sizeof(FreeNode) ? sizeof(FreeNode) : inNodeSize)),
+		slabs(nullptr), cursor(nullptr), slabEnd(nullptr), freeList(nullptr), nextSlabNodes(MinSlabNodes) {}
+	~NodeArena() { releaseAll(); }
+
+	NodeArena(const NodeArena&) = delete;
+	NodeArena& operator=(const NodeArena&) = delete;
+
+	// --------------------
+	// Member operator
+	// --------------------
+
+	void* allocate();
+	void deallocate(void* p);
+
+	// Release all slabs at once, objects in them are not destructed
+	void releaseAll();
+
+	// Take all slabs and free nodes of other, used when nodes are moved from another tree.
+	void merge(NodeArena& other);
+
+	size_t getNodeSize() const { return nodeSize; }
+
+	static const bool CanMerge = true;
+
+private:
+	struct Slab
+	{
+		Slab* next;
+	};
+	struct FreeNode
+	{
+		FreeNode* next;
+	};
+
+	static const size_t Alignment = alignof(std::max_align_t);
+	static const size_t MinSlabNodes = 32;
+	static const size_t MaxSlabNodes = 64 * 1024;
+
+	static size_t roundUp(size_t n) { return (n + Alignment - 1) / Alignment * Alignment; }
+
+	void allocateSlab();
+
+	size_t nodeSize;
+	Slab* slabs;
+	char* cursor;  // Nodes of the newest slab are given out from cursor to slabEnd
+	char* slabEnd;
+	FreeNode* freeList;
+	size_t nextSlabNodes;
+};
+
+inline void* NodeArena::allocate()
+{
+	if (freeList)
+	{
+		FreeNode* node = freeList;
+		freeList = node->next;
+		return node;
+	}
+	if (cursor == slabEnd) allocateSlab();
+	void* p = cursor;
+	cursor += nodeSize;
+	return p;
+}
+
+inline void NodeArena::deallocate(void* p)
+{
+	if (!p) return;
+	FreeNode* node = static_cast<FreeNode*>(p);
+	node->next = freeList;
+	freeList = node;
+}
+
+inline void NodeArena::allocateSlab()
+{
+	const size_t header = roundUp(sizeof(Slab));
+	char* memory = static_cast<char*>(::operator new(header + nodeSize * nextSlabNodes));
+	Slab* slab = reinterpret_cast<Slab*>(memory);
+	slab->next = slabs;
+	slabs = slab;
+	cursor = memory + header;
+	slabEnd = cursor + nodeSize * nextSlabNodes;
+	if (nextSlabNodes < MaxSlabNodes) nextSlabNodes *= 2;
+}
+
+inline void NodeArena::releaseAll()
+{
+	while (slabs)
+	{
+		Slab* next = slabs->next;
+		::operator delete(slabs);
+		slabs = next;
+	}
+	cursor = slabEnd = nullptr;
+	freeList = nullptr;
+	nextSlabNodes = MinSlabNodes;
+}
+
+inline void NodeArena::merge(NodeArena& other)
+{
+	assert(nodeSize == other.nodeSize);
+	if (&other == this) return;
+
+	if (other.slabs)
+	{
+		Slab* last = other.slabs;
+		while (last->next) last = last->next;
+		last->next = slabs;
+		slabs = other.slabs;
+	}
+
+	// The unused part of other's newest slab is given to free list
+	for (; other.cursor != other.slabEnd; other.cursor += other.nodeSize)
+	{
+		deallocate(other.cursor);
+	}
+	while (other.freeList)
+	{
+		FreeNode* node = other.freeList;
+		other.freeList = node->next;
+		deallocate(node);
+	}
+
+	other.slabs = nullptr;
+	other.cursor = other.slabEnd = nullptr;
+	other.nextSlabNodes = MinSlabNodes;
+}
+
+// --------------------
+// Arena of nodes named by 32 bits index, used by the compact node format.
+// Slabs have the same size and are aligned to it, so a node can find the slab header from its own address,
+// and the header points to the slab table of arena. The high bits of index are the slab and the low bits are the slot.
+// --------------------
+
+template<typename Node>
+class IndexedNodeArena
+{
+public:
+	static const unsigned NullIndex = ~0u;
+
+	// Index is local to the arena, nodes can't be moved to another arena.
+	static const bool CanMerge = false;
+
+	explicit IndexedNodeArena(size_t nodeSize)
+		:slabs(nullptr), slabCount(0), slabCapacity(0), nextSlot(0), freeList(NullIndex)
+	{
+		assert(nodeSize == sizeof(Node));
+	}
+	~IndexedNodeArena() { releaseAll(); }
+
+	IndexedNodeArena(const IndexedNodeArena&) = delete;
+	IndexedNodeArena& operator=(const IndexedNodeArena&) = delete;
+
+	void* allocate();
+	void deallocate(void* p);
+	void releaseAll();
+
+	size_t getNodeSize() const { return sizeof(Node); }
+
+	static unsigned indexOf(const Node* node);
+
+	// Get the node of index in the arena which p is in
+	static Node* nodeAt(const void* p, unsigned index);
+
+private:
+	struct SlabHeader
+	{
+		char** table;
+		unsigned number;
+	};
+	static constexpr unsigned bitWidth(unsigned n) { return n ? 1 + bitWidth(n >> 1) : 0; }
+
+	static const size_t SlabBytes = 256 * 1024;
+	static const size_t HeaderBytes = (sizeof(SlabHeader) + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+	static const unsigned SlotsPerSlab = static_cast<unsigned>((SlabBytes - HeaderBytes) / sizeof(Node));
+	static const unsigned SlotBits = bitWidth(SlotsPerSlab - 1);
+	static const unsigned MaxSlabCount = (1u << (32 - SlotBits)) - 1;  // The last one is kept for NullIndex
+
+	static const SlabHeader* headerOf(const void* p)
+	{
+		return reinterpret_cast<const SlabHeader*>(reinterpret_cast<uintptr_t>(p) & ~static_cast<uintptr_t>(SlabBytes - 1));
+	}
+
+	void allocateSlab();
+
+	char** slabs;
+	unsigned slabCount;
+	unsigned slabCapacity;
+	unsigned nextSlot;  // Next unused slot in the newest slab
+	unsigned freeList;  // Free slots are linked by index, compact nodes may be only 4 bytes aligned
+};
+
+template<typename Node>
+inline void* IndexedNodeArena<Node>::allocate()
+{
+	static_assert(sizeof(Node) >= sizeof(unsigned) && alignof(Node) >= alignof(unsigned), "Node can't hold the free list");
+
+	if (freeList != NullIndex)
+	{
+		Node* node = nodeAt(slabs[0], freeList);
+		freeList = *reinterpret_cast<unsigned*>(node);
+		return node;
+	}
+	if (slabCount == 0 || nextSlot == SlotsPerSlab) allocateSlab();
+	return slabs[slabCount - 1] + HeaderBytes + sizeof(Node) * nextSlot++;
+}
+
+template<typename Node>
+inline void IndexedNodeArena<Node>::deallocate(void* p)
+{
+	if (!p) return;
+	const unsigned index = indexOf(static_cast<Node*>(p));
+	*static_cast<unsigned*>(p) = freeList;
+	freeList = index;
+}
+
+template<typename Node>
+inline void IndexedNodeArena<Node>::allocateSlab()
+{
+	if (slabCount == MaxSlabCount) throw std::bad_alloc();
+
+	if (slabCount == slabCapacity)
+	{
+		// Headers point to the table, update them after it's moved
+		slabCapacity = slabCapacity ? slabCapacity * 2 : 8;
+		char** table = new char*[slabCapacity];
+		for (unsigned i = 0; i < slabCount; ++i)
+		{
+			table[i] = slabs[i];
+			reinterpret_cast<SlabHeader*>(slabs[i])->table = table;
+		}
+		delete[] slabs;
+		slabs = table;
+	}
+
+	void* memory = nullptr;
+#ifdef _WIN32
+	memory = _aligned_malloc(SlabBytes, SlabBytes);
+#else
+	if (posix_memalign(&memory, SlabBytes, SlabBytes) != 0) memory = nullptr;
+#endif
+	if (!memory) throw std::bad_alloc();
+
+	SlabHeader* header = static_cast<SlabHeader*>(memory);
+	header->table = slabs;
+	header->number = slabCount;
+	slabs[slabCount++] = static_cast<char*>(memory);
+	nextSlot = 0;
+}
+
+template<typename Node>
+inline void IndexedNodeArena<Node>::releaseAll()
+{
+	for (unsigned i = 0; i < slabCount; ++i)
+	{
+#ifdef _WIN32
+		_aligned_free(slabs[i]);
+#else
+		free(slabs[i]);
+#endif
+	}
+	delete[] slabs;
+	slabs = nullptr;
+	slabCount = slabCapacity = nextSlot = 0;
+	freeList = NullIndex;
+}
+
+template<typename Node>
+inline unsigned IndexedNodeArena<Node>::indexOf(const Node* node)
+{
+	const SlabHeader* header = headerOf(node);
+	const size_t offset = reinterpret_cast<const char*>(node) - reinterpret_cast<const char*>(header) - HeaderBytes;
+	return header->number << SlotBits | static_cast<unsigned>(offset / sizeof(Node));
+}
+
+template<typename Node>
+inline Node* IndexedNodeArena<Node>::nodeAt(const void* p, unsigned index)
+{
+	const char* slab = headerOf(p)->table[index >> SlotBits];
+	return reinterpret_cast<Node*>(const_cast<char*>(slab) + HeaderBytes + sizeof(Node) * (index & ((1u << SlotBits) - 1)));
+}
+
+// Link between nodes in IndexedNodeArena, it works like Node* but takes 4 bytes.
+// It must be a member of a node in the same arena, because it finds the arena from its own address.
+template<typename Node>
+class IndexedNodeLink
+{
+public:
+	explicit IndexedNodeLink(Node* node = nullptr) :index(encode(node)) {}
+
+	IndexedNodeLink(const IndexedNodeLink&) = delete;
+	IndexedNodeLink& operator=(const IndexedNodeLink& rhs)
+	{
+		index = rhs.index;  // Same arena, the index can be copied
+		return *this;
+	}
+	IndexedNodeLink& operator=(Node* node)
+	{
+		index = encode(node);
+		return *this;
+	}
+
+	operator Node*() const { return index == IndexedNodeArena<Node>::NullIndex ? nullptr : IndexedNodeArena<Node>::nodeAt(this, index); }
+	Node* operator->() const { return *this; }
+
+private:
+	static unsigned encode(const Node* node) { return node ? IndexedNodeArena<Node>::indexOf(node) : IndexedNodeArena<Node>::NullIndex; }
+
+	unsigned index;
+};
@@ -0,0 +1,366 @@
+#pragma once
+#include <atomic>
+#include <cassert>
+
+#include "BinNode.h"
+#include "FixedVector.h"
+
+// Red-black tree whose versions share nodes. Nodes have no parent link and a shared node is never changed,
+// insert and erase copy the nodes on the search path and the siblings they recolor, O(log n) nodes.
+// Copying the tree takes a snapshot in O(1), it keeps the content of that time however the tree is changed later.
+// Nodes are reference counted, a node is deleted with the last version using it.
+// Nodes only used by this version are changed in place, so the tree doesn't copy anything if no snapshot is kept.
+// A tree object is not thread safe, but versions sharing nodes can be used on different threads,
+// so readers can keep their snapshots while a writer goes on.
+template<typename T>
+class PersistentRedBlackTree
+{
+public:
+	// --------------------
+	// Constructor and destructor
+	// --------------------
+	PersistentRedBlackTree() :_root(nullptr), _size(0) {}
+	PersistentRedBlackTree(const PersistentRedBlackTree& rhs) :_root(retain(rhs._root)), _size(rhs._size) {}
+	PersistentRedBlackTree& operator=(const PersistentRedBlackTree& rhs)
+	{
+		Node* root = retain(rhs._root);  // Retain first, rhs may be this
+		release(_root);
+		_root = root;
+		_size = rhs._size;
+		return *this;
+	}
+	~PersistentRedBlackTree() { release(_root); }
+
+	// --------------------
+	// Member operator
+	// --------------------
+	PersistentRedBlackTree snapshot() const { return *this; }
+
+	int size() const { return _size; }
+	bool empty() const { return !_root; }
+	void clear()
+	{
+		release(_root);
+		_root = nullptr;
+		_size = 0;
+	}
+	void swap(PersistentRedBlackTree& rhs)
+	{
+		Node* root = _root;
+		_root = rhs._root;
+		rhs._root = root;
+		int size = _size;
+		_size = rhs._size;
+		rhs._size = size;
+	}
+
+	// Element equal to val, nullptr if there is none. It's valid until this tree is changed or destroyed.
+	const T* search(const T& val) const;
+	bool contains(const T& val) const { return search(val) != nullptr; }
+
+	// Return false if val is already in tree
+	bool insert(const T& val);
+	bool erase(const T& val);
+
+	// Call func on every element in order
+	template<typename FUNC> void traversalInorder(FUNC func) const;
+
+	// Black height of tree, -1 if any rule of red-black tree or the order is broken. O(n), for debugging.
+	int checkBlackHeight() const { return isRed(_root) ? -1 : checkBlackHeight(_root); }
+
+private:
+	struct Node
+	{
+		Node(const T& inData, RBColor inColor, Node* l = nullptr, Node* r = nullptr)
+			:data(inData), lChild(l), rChild(r), refCount(1), color(inColor) {}
+
+		T data;
+		Node* lChild;
+		Node* rChild;
+		std::atomic<unsigned> refCount;  // Number of parents and trees pointing to it
+		RBColor color;
+	};
+
+	// Height of red-black tree is at most 2log(n+1), erase may push one more node to the path.
+	static const unsigned MaxDepth = 2 * 8 * sizeof(int) + 2;
+	typedef FixedVector<Node*, MaxDepth> Path;
+
+	static bool isBlack(const Node* node) { return !node || node->color == BLACK; }
+	static bool isRed(const Node* node) { return !isBlack(node); }
+	static Node*& childOf(Node* node, bool isLeft) { return isLeft ? node->lChild : node->rChild; }
+
+	static Node* retain(Node* node)
+	{
+		if (node) node->refCount.fetch_add(1, std::memory_order_relaxed);
+		return node;
+	}
+	static void release(Node* node);
+
+	// Make the node of link only used by this version, it's copied if it's shared.
+	// link must be _root or in a node owned by this version, so a count of 1 means nobody else can see the node.
+	static Node* own(Node*& link);
+
+	// Rotate the child on side isLeft up and return it, both nodes must be owned
+	static Node* rotateUp(Node* node, bool isLeft);
+
+	// Replace path[index] with node in its parent, or root
+	void relink(const Path& path, unsigned index, Node* node);
+
+	void solveDoubleBlack(Path& path, Node* node);
+
+	static int checkBlackHeight(const Node* node);
+
+	Node* _root;
+	int _size;
+};
+
+template<typename T>
+inline void PersistentRedBlackTree<T>::release(Node* node)
+{
+	if (!node || node->refCount.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+	// Depth of recursion is the height of tree
+	release(node->lChild);
+	release(node->rChild);
+	delete node;
+}
+
+template<typename T>
+inline typename PersistentRedBlackTree<T>::Node* PersistentRedBlackTree<T>::own(Node*& link)
+{
+	Node* node = link;
+	if (node->refCount.load(std::memory_order_acquire) == 1) return node;
+
+	Node* copy = new Node(node->data, node->color, retain(node->lChild), retain(node->rChild));
+	release(node);
+	link = copy;
+	return copy;
+}
+
+template<typename T>
+inline typename PersistentRedBlackTree<T>::Node* PersistentRedBlackTree<T>::rotateUp(Node* node, bool isLeft)
+{
+	Node* child = childOf(node, isLeft);
+	childOf(node, isLeft) = childOf(child, !isLeft);
+	childOf(child, !isLeft) = node;
+	return child;
+}
+
+template<typename T>
+inline void PersistentRedBlackTree<T>::relink(const Path& path, unsigned index, Node* node)
+{
+	if (index == 0)
+	{
+		_root = node;
+		return;
+	}
+	Node* parent = path[index - 1];
+	childOf(parent, parent->lChild == path[index]) = node;
+}
+
+template<typename T>
+inline const T* PersistentRedBlackTree<T>::search(const T& val) const
+{
+	const Node* node = _root;
+	while (node)
+	{
+		if (val < node->data) node = node->lChild;
+		else if (val > node->data) node = node->rChild;
+		else return &node->data;
+	}
+	return nullptr;
+}
+
+template<typename T>
+bool PersistentRedBlackTree<T>::insert(const T& val)
+{
+	// Search first, so nothing is copied if val is there
+	if (search(val)) return false;
+	++_size;
+
+	if (!_root)
+	{
+		_root = new Node(val, BLACK);
+		return true;
+	}
+
+	// Own the nodes on the way down, the new node is red
+	Path path;
+	Node* node = own(_root);
+	while (true)
+	{
+		path.push_back(node);
+		Node*& link = childOf(node, val < node->data);
+		if (!link)
+		{
+			node = link = new Node(val, RED);
+			break;
+		}
+		node = own(link);
+	}
+
+	// Solve the double red from bottom up, path[i - 1] is the parent of node
+	unsigned i = path.size();
+	while (i >= 2 && isRed(path[i - 1]))
+	{
+		Node* p = path[i - 1];
+		Node* g = path[i - 2];  // p is red so it's not root
+		const bool isLeft = g->lChild == p;
+		Node*& uncle = childOf(g, !isLeft);
+
+		if (isRed(uncle))
+		{
+			// Switch the color, g is red now, consider the double red on higher level
+			own(uncle)->color = BLACK;
+			p->color = BLACK;
+			g->color = RED;
+			node = g;
+			i -= 2;
+		}
+		else
+		{
+			// Turn node to the outer side of p, then rotate p over g
+			if (childOf(p, !isLeft) == node)
+			{
+				p = rotateUp(p, !isLeft);
+				childOf(g, isLeft) = p;
+			}
+			p->color = BLACK;
+			g->color = RED;
+			relink(path, i - 2, rotateUp(g, isLeft));
+			break;
+		}
+	}
+
+	_root->color = BLACK;
+	return true;
+}
+
+template<typename T>
+bool PersistentRedBlackTree<T>::erase(const T& val)
+{
+	if (!search(val)) return false;
+	--_size;
+
+	// Own the nodes down to val, and down to its successor if it has two children
+	Path path;
+	Node* node = own(_root);
+	while (val < node->data || val > node->data)
+	{
+		path.push_back(node);
+		node = own(childOf(node, val < node->data));
+	}
+	if (node->lChild && node->rChild)
+	{
+		Node* target = node;
+		path.push_back(node);
+		node = own(node->rChild);
+		while (node->lChild)
+		{
+			path.push_back(node);
+			node = own(node->lChild);
+		}
+		target->data = node->data;
+	}
+
+	// node has one child at most, the child takes its place
+	Node* child = node->lChild ? node->lChild : node->rChild;
+	Node*& link = path.empty() ? _root : childOf(path.back(), path.back()->lChild == node);
+	const bool isDeleteNodeBlack = isBlack(node);
+	link = child;
+	node->lChild = node->rChild = nullptr;
+	release(node);
+
+	if (!isDeleteNodeBlack) return true;
+	if (isRed(child))
+	{
+		own(link)->color = BLACK;
+		return true;
+	}
+	solveDoubleBlack(path, child);
+	return true;
+}
+
+template<typename T>
+void PersistentRedBlackTree<T>::solveDoubleBlack(Path& path, Node* node)
+{
+	// The subtree of node (could be nullptr) is one black less than its sibling, path.back() is its parent
+	while (!path.empty())
+	{
+		Node* p = path.back();
+		const bool isLeft = p->lChild == node;
+		Node* s = own(childOf(p, !isLeft));  // Not nullptr, it has more black. It's changed in every case.
+
+		if (isRed(s))
+		{
+			// Rotate s over p, the new sibling is black and p is red
+			s->color = BLACK;
+			p->color = RED;
+			relink(path, path.size() - 1, rotateUp(p, !isLeft));
+			path.pop_back();
+			path.push_back(s);
+			path.push_back(p);
+			continue;
+		}
+
+		if (isRed(childOf(s, !isLeft)) || isRed(childOf(s, isLeft)))
+		{
+			if (isBlack(childOf(s, !isLeft)))
+			{
+				// Turn the red child to the outer side
+				own(childOf(s, isLeft));
+				s = rotateUp(s, isLeft);
+				childOf(p, !isLeft) = s;
+			}
+
+			// Rotate s over p, s takes the color of p and both its children are black
+			own(childOf(s, !isLeft))->color = BLACK;
+			s->color = p->color;
+			p->color = BLACK;
+			relink(path, path.size() - 1, rotateUp(p, !isLeft));
+			return;
+		}
+
+		// Both children of s are black, s turns red so the subtree of p is one black less
+		s->color = RED;
+		if (isRed(p))
+		{
+			p->color = BLACK;
+			return;
+		}
+		node = p;
+		path.pop_back();
+	}
+}
+
+template<typename T>
+template<typename FUNC>
+void PersistentRedBlackTree<T>::traversalInorder(FUNC func) const
+{
+	Stack<const Node*, FixedVector<const Node*, MaxDepth>> s;
+	const Node* node = _root;
+	while (true)
+	{
+		for (; node; node = node->lChild) s.push(node);
+		if (s.empty()) return;
+
+		node = s.top();
+		s.pop();
+		func(node->data);
+		node = node->rChild;
+	}
+}
+
+template<typename T>
+int PersistentRedBlackTree<T>::checkBlackHeight(const Node* node)
+{
+	if (!node) return 0;
+	if (isRed(node) && (isRed(node->lChild) || isRed(node->rChild))) return -1;
+	if (node->lChild && !(node->lChild->data < node->data)) return -1;
+	if (node->rChild && !(node->data < node->rChild->data)) return -1;
+
+	int lHeight = checkBlackHeight(node->lChild);
+	int rHeight = checkBlackHeight(node->rChild);
+	if (lHeight < 0 || lHeight != rHeight) return -1;
+	return isBlack(node) ? lHeight + 1 : lHeight;
+}
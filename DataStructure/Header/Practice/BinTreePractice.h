@@ -1,8 +1,7 @@
 #pragma once
 #include "BinTree.h"
 #include "Vector"
-
-#include <map>
+#include "HashMap.h"
 
 class PFCTree
 {
@@ -29,6 +28,6 @@ private:
 
 	PFCTreeType* PFCCodeTree;
 	Vector<PFCTreeType*> PFCForest;
-	std::map<char, PFCCodeType> PFCTable;
+	HashMap<char, PFCCodeType> PFCTable;
 	Vector<PFCCodeType> codeArray;
 };
\ No newline at end of file
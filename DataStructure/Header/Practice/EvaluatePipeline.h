@@ -0,0 +1,25 @@
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <iostream>
+
+// Evaluate many newline-delimited expressions, one result per line is written in input order.
+// Invalid expressions and failed calculations are written as "error".
+// The input is split to chunks of lines which are evaluated on the pool, and a reorder buffer
+// keeps the output in order. Pass a ThreadPool with certain number of threads to measure the scaling.
+
+struct EvaluatePipelineStats
+{
+	unsigned long long expressionCount;
+	unsigned chunkCount;
+	double seconds;
+	double expressionsPerSecond;
+	double p99ChunkLatency;  // Seconds to evaluate one chunk
+};
+
+// Read from a memory mapped file, return false if the file can't be opened.
+bool evaluateFile(const char* path, std::ostream& out, EvaluatePipelineStats* stats = nullptr, ThreadPool& pool = ThreadPool::instance());
+
+// Read from a stream like std::cin.
+void evaluateStream(std::istream& in, std::ostream& out, EvaluatePipelineStats* stats = nullptr, ThreadPool& pool = ThreadPool::instance());
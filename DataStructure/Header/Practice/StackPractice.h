@@ -3,8 +3,10 @@
 #include "Stack.h"
 #include "Vector.h"
 #include "List.h"
+#include "ThreadPool.h"
 
 #include <cctype>
+#include <cstddef>
 
 template<typename Stack>
 void numeralConvert(long long number, int base, Stack& result)
@@ -18,6 +20,14 @@ void numeralConvert(long long number, int base, Stack& result)
 	}
 }
 
+// Format number in base [2, MaxIntegerBase] to buffer with '\0' at the end, digits larger than 9 are upper case letters.
+// Return the length without '\0', or 0 if base is not supported. buffer should have IntegerFormatBufferSize chars.
+const int MaxIntegerBase = 36;
+const unsigned IntegerFormatBufferSize = 66;  // Sign, 64 binary digits and '\0'
+unsigned formatInteger(long long number, int base, char* buffer);
+// Append every number followed by separator to text.
+void formatIntegers(const Vector<long long>& numbers, int base, Vector<char>& text, char separator = '\n');
+
 template<unsigned N>
 bool isValidExpression(const char(&exp)[N])
 {
@@ -54,14 +64,114 @@ bool isValidExpression(const char(&exp)[N])
 	return s.empty();
 }
 
+// Validate brackets of a long text given in chunks, a chunk can end anywhere.
+// Other characters are skipped 32 bytes at a time with SIMD if it's available.
+class BracketValidator
+{
+public:
+	BracketValidator() { reset(); }
+
+	void reset();
+	// Return false once the text is invalid
+	bool feed(const char* data, size_t length);
+	// Call after all chunks are fed, return true if all brackets are matched
+	bool finish() const { return !hasError && depth == 0; }
+	unsigned long long getDepth() const { return depth; }
+
+private:
+	static const unsigned LevelsPerWord = 32;
+
+	void pushBracket(unsigned code);
+	bool popBracket(unsigned code);
+	bool processBracket(char c);
+
+	// Every level of the stack is 2 bits, (, [ and { are 1, 2 and 3.
+	// topWord has the levels not in fullWords.
+	Vector<unsigned long long> fullWords;
+	unsigned long long topWord;
+	unsigned long long depth;
+	bool hasError;
+};
+bool isValidExpression(const char* exp, size_t length);
+
 // Evaluate an expression and get the RPN(Reverse Polish notation).
+// T could be float, double or long long. Integer evaluation is exact, fraction numbers, division by zero
+// and overflow make it fail. Return 0 if the expression is invalid or the calculation fails.
 typedef float EvaluateResultType;
-EvaluateResultType evaluate(const char* exp, Vector<char>& RPN);
+template<typename T = EvaluateResultType> T evaluate(const char* exp, Vector<char>& RPN);
+// Evaluate without generating RPN, return false if the expression is invalid or the calculation fails.
+template<typename T> bool tryEvaluate(const char* exp, T& result);
+
+template<typename T> class BasicProgram;
+typedef BasicProgram<EvaluateResultType> Program;
+
+// Return an invalid program if the expression can't be compiled.
+// If optimize is true, the expression is parsed to a tree first, then constants are folded,
+// simple patterns like x*1, x+0, x^2 are rewritten, and common subexpressions are calculated only once.
+template<typename T = EvaluateResultType> BasicProgram<T> compile(const char* exp, bool optimize = true);
+
+// Compile an expression to bytecode once, then run it with different variable values.
+// Variables are identifiers in the expression, like "x*x+2*y".
+// The values are passed to run() by index, use variableIndex() to get the index of a variable.
+template<typename T>
+class BasicProgram
+{
+public:
+	enum OpCode :unsigned char { PUSH_CONST, PUSH_VAR, LOAD_TEMP, STORE_TEMP, ADD, SUB, MUL, DIV, POW, FAC, NEG };
+
+	// PUSH_CONST, PUSH_VAR, LOAD_TEMP and STORE_TEMP are followed by one byte of operand index.
+	// Temps keep the common subexpressions found by optimization.
+	static const unsigned MaxOperand = 0xff;
+	static const unsigned MaxStackDepth = 64;
+
+	BasicProgram() :maxStackDepth(0), tempCount(0) {}
+
+	bool valid() const { return !code.empty(); }
+	unsigned variableCount() const { return variables.size(); }
+	const char* variableName(unsigned i) const { return variables[i].begin(); }
+	int variableIndex(const char* name) const;
+
+	// Return false if the calculation fails, like integer overflow.
+	bool run(const T* vars, T& result) const;
+	T run(const T* vars = nullptr) const
+	{
+		T result;
+		return run(vars, result) ? result : T();
+	}
+
+	// Evaluate for every row of columnar inputs, columns[i] is the column of variable i.
+	// Each operator is applied to a whole block of rows at a time, blocks are spread on the shared ThreadPool.
+	// Return false if the calculation of any row fails.
+	static const unsigned BatchBlockSize = 1024;
+	bool runBatch(const T* const* columns, unsigned rowCount, T* output, bool parallel = true) const;
+
+private:
+	// scratch should have room for maxStackDepth + tempCount blocks
+	bool runBlock(const T* const* columns, unsigned rowBegin, unsigned count, T* output, T* scratch) const;
+
+	Vector<unsigned char> code;
+	Vector<T> constants;
+	Vector<Vector<char>> variables;
+	unsigned maxStackDepth;
+	unsigned tempCount;
+
+	template<typename U> friend BasicProgram<U> compile(const char* exp, bool optimize);
+};
 
 // N Queen Problem
 struct Position2D
 {
 	int x, y;
 };
+// Solutions are in lexicographic order of queen columns, Position2D::x is the row and y is the column.
 void placeNQueen(int N, List<List<Position2D>>& solutions);
+unsigned long long countNQueen(int N);
+
+// Parallel N Queen on the pool. A solution is N bytes, the column of queen in every row.
+unsigned long long countNQueenParallel(int N, ThreadPool& pool = ThreadPool::instance());
+// onSolution is called from the threads of pool concurrently, in no particular order.
+typedef std::function<void(const unsigned char* queenColumns)> NQueenSolutionCallback;
+void forEachNQueenSolution(int N, const NQueenSolutionCallback& onSolution, ThreadPool& pool = ThreadPool::instance());
+// Append all solutions to solutionRows in the same order as placeNQueen.
+void placeNQueenParallel(int N, Vector<unsigned char>& solutionRows, ThreadPool& pool = ThreadPool::instance());
 void printNQueenSolution(List<Position2D>& solution);
\ No newline at end of file
@@ -23,6 +23,18 @@ protected:
 
 	void solveDoubleRed(BinNode<T>* pos);
 	void solveDoubleBlack(BinNode<T>* pos);
+
+	virtual BinNode<T>* joinNodes(BinNode<T>* l, BinNode<T>* k, BinNode<T>* r) override;
+	using BinarySearchTree<T>::joinNodes;
+
+	virtual void settleRoot(BinNode<T>* root) override { makeBlack(root); }
+	// A red root can be black, the black height of all its paths increase
+	static void makeBlack(BinNode<T>* root)
+	{
+		if (isBlack(root)) return;
+		root->_color = BLACK;
+		root->_height++;
+	}
 };
 
 template<typename T>
@@ -33,10 +45,11 @@ inline BinNode<T>* RedBlackTree<T>::insert(const T & val)
 		this->insertAsRoot(val);
 		this->_root->_color = BLACK;
 		updateHeight(this->_root);
+		this->addToSearchFilter(val);
 		return this->_root;
 	}
 
-	BinNode<T>* pos = this->search(val);
+	BinNode<T>* pos = this->searchIn(this->_root, val);
 	if (pos) return pos;
 	else
 	{
@@ -44,14 +57,17 @@ inline BinNode<T>* RedBlackTree<T>::insert(const T & val)
 		BinNode<T>* ret = nullptr;
 		if (val > this->_hot->getData())
 		{
-			ret = this->_hot->insertAsRChild(new BinNode<T>(val));
+			ret = this->_hot->insertAsRChild(this->createNode(val));
 		}
 		else
 		{
-			ret = this->_hot->insertAsLChild(new BinNode<T>(val));
+			ret = this->_hot->insertAsLChild(this->createNode(val));
 		}
+		this->threadInserted(ret);
 		++(this->_size);
 		updateHeight(ret);
+		this->updateSubtreeAbove(this->_hot);  // Before rotation, it needs the right sizes and aggregates of subtrees
+		this->addToSearchFilter(val);
 
 		solveDoubleRed(ret);
 
@@ -65,7 +81,8 @@ inline bool RedBlackTree<T>::erase(const T & val)
 	BinNode<T>* pos = this->search(val);
 	if (pos)
 	{
-		bool isDeleteNodeBlack = isBlack(pos);
+		// A node with two children is swapped with its successor, the color of that position is removed
+		bool isDeleteNodeBlack = isBlack(pos->hasLChild() && pos->hasRChild() ? pos->succ() : pos);
 		BinNode<T>* ret = this->eraseAt(pos);
 		--(this->_size);
 
@@ -81,6 +98,7 @@ inline bool RedBlackTree<T>::erase(const T & val)
 				solveDoubleBlack(ret);
 			}
 		}
+		this->onErasedForSearchFilter();
 
 		return true;
 	}
@@ -90,6 +108,49 @@ inline bool RedBlackTree<T>::erase(const T & val)
 	}
 }
 
+template<typename T>
+BinNode<T>* RedBlackTree<T>::joinNodes(BinNode<T>* l, BinNode<T>* k, BinNode<T>* r)
+{
+	makeBlack(l);
+	makeBlack(r);
+	const int lHeight = stature(l);
+	const int rHeight = stature(r);
+	if (lHeight == rHeight)
+	{
+		k->_color = BLACK;
+		return BinarySearchTree<T>::joinNodes(l, k, r);
+	}
+
+	// Go down the side of the higher tree to a black subtree of the same black height as the other tree,
+	// k takes its place as a red node with it and the other tree, then solve the double red like an insert.
+	k->_color = RED;
+	BinNode<T>* p;
+	if (lHeight > rHeight)
+	{
+		p = l;
+		while (isRed(p->rChild) || stature(p->rChild) > rHeight) p = p->rChild;
+		BinNode<T>* c = p->rChild;
+		if (c) c->parent = nullptr;
+		p->rChild = nullptr;
+		p->insertAsRChild(BinarySearchTree<T>::joinNodes(c, k, r));
+	}
+	else
+	{
+		p = r;
+		while (isRed(p->lChild) || stature(p->lChild) > lHeight) p = p->lChild;
+		BinNode<T>* c = p->lChild;
+		if (c) c->parent = nullptr;
+		p->lChild = nullptr;
+		p->insertAsLChild(BinarySearchTree<T>::joinNodes(l, k, c));
+	}
+	this->updateSubtreeAbove(p);
+	solveDoubleRed(k);
+
+	BinNode<T>* root = k;
+	while (root->parent) root = root->parent;
+	return root;
+}
+
 template<typename T>
 inline bool RedBlackTree<T>::isBlackHeightUpdated(BinNode<T>* node)
 {
@@ -107,6 +168,7 @@ inline void RedBlackTree<T>::updateHeight(BinNode<T>* node)
 	int rHeight = stature(node->rChild);
 	node->_height = lHeight > rHeight ? lHeight : rHeight;
 	if (isBlack(node)) node->_height++;
+	this->updateSubtree(node);
 }
 
 template<typename T>
@@ -114,7 +176,7 @@ inline void RedBlackTree<T>::solveDoubleRed(BinNode<T>* pos)
 {
 	BinNode<T>* v = pos;
 	BinNode<T>* p = v->parent;
-	BinNode<T>* g = p ? p->parent : nullptr;
+	BinNode<T>* g = p ? p->getParent() : nullptr;
 	BinNode<T>* u = nullptr;
 
 	while (p&&g)
@@ -166,7 +228,7 @@ inline void RedBlackTree<T>::solveDoubleRed(BinNode<T>* pos)
 			// g is red now, consider the double red on higher level
 			v = g;
 			p = v->parent;
-			g = p ? p->parent : nullptr;
+			g = p ? p->getParent() : nullptr;
 		}
 	}
 
@@ -206,15 +268,17 @@ inline void RedBlackTree<T>::solveDoubleBlack(BinNode<T>* pos)
 			if (isRed(s->rChild)) n = s->rChild;
 			if (n)
 			{
-				s->_color = p->_color;
-				p->_color = BLACK;
-				n->_color = BLACK;
-
-				this->rotateAt(n);
-
-				updateHeight(n);
-				updateHeight(p);
-				updateHeight(s);
+				// The new root of three nodes takes the color of p, both of its children are black.
+				// It's s or n, depending on the side of n.
+				RBColor color = p->_color;
+				BinNode<T>* r = this->rotateAt(n);
+				r->lChild->_color = BLACK;
+				r->rChild->_color = BLACK;
+				r->_color = color;
+
+				updateHeight(r->lChild);
+				updateHeight(r->rChild);
+				updateHeight(r);
 
 				return;
 			}
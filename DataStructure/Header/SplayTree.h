@@ -30,22 +30,24 @@ inline BinNode<T>* SplayTree<T>::insert(const T & val)
 	BinNode<T>* pos = search(val);
 	if (pos->getData() < val)
 	{
-		this->_root = new BinNode<T>(val);
+		this->_root = this->createNode(val);
 		this->_root->lChild = pos;
 		pos->parent = this->_root;
 		this->_root->rChild = pos->rChild;
 		if (pos->rChild) pos->rChild->parent = this->_root;
 		pos->rChild = nullptr;
+		this->threadInserted(this->_root);
 		++(this->_size);
 	}
 	else if(pos->getData() > val)
 	{
-		this->_root = new BinNode<T>(val);
+		this->_root = this->createNode(val);
 		this->_root->rChild = pos;
 		pos->parent = this->_root;
 		this->_root->lChild = pos->lChild;
 		if (pos->lChild) pos->lChild->parent = this->_root;
 		pos->lChild = nullptr;
+		this->threadInserted(this->_root);
 		++(this->_size);
 	}
 	this->updateHeightAbove(pos);
@@ -57,7 +59,8 @@ inline bool SplayTree<T>::erase(const T & val)
 {
 	BinNode<T>* pos = search(val);
 	if (pos->getData() != val) return false;
-	
+	this->unthreadNode(pos);
+
 	pos->rChild->parent = nullptr;
 	BinNode<T>* newRoot = this->searchIn(pos->rChild, val);
 	if (!newRoot) newRoot = this->_hot;
@@ -67,7 +70,7 @@ inline bool SplayTree<T>::erase(const T & val)
 	pos->lChild->parent = newRoot;
 	newRoot->parent = nullptr;
 
-	delete pos;
+	this->destroyNode(pos);
 	--(this->_size);
 	this->updateHeightAbove(this->_root);
 	return true;
@@ -78,7 +81,7 @@ inline BinNode<T>* SplayTree<T>::splay(BinNode<T>* pos)
 {
 	BinNode<T>* v = pos;
 	BinNode<T>* p = v->parent;
-	BinNode<T>* g = p ? p->parent : nullptr;
+	BinNode<T>* g = p ? p->getParent() : nullptr;
 
 	while (p && g)
 	{
@@ -0,0 +1,227 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "Vector.h"
+
+// Work-stealing thread pool for fork-join parallelism.
+// Every worker owns a task deque, it push and pop at the back, idle workers steal from the front of others.
+// Threads outside the pool submit to a shared queue.
+// A thread waiting on TaskGroup keeps running tasks, so a task can fork subtasks and wait for them.
+class ThreadPool
+{
+public:
+	class TaskGroup;
+
+	// The calling thread take part in the work when it waits, so only threadCount - 1 workers are created.
+	explicit ThreadPool(unsigned threadCount = std::thread::hardware_concurrency());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// The pool shared by all parallel algorithms, created on first use.
+	static ThreadPool& instance()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+
+	unsigned threadCount() const { return workers.size() + 1; }
+
+	// Call func(i) for every i in [0, n) and wait for all of them.
+	template<typename FUNC> void parallelFor(unsigned n, const FUNC& func);
+
+private:
+
+	struct Task
+	{
+		std::function<void()> func;
+		TaskGroup* group;
+	};
+
+	struct TaskQueue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	void submit(Task&& task);
+	bool runOneTask();
+	void workerLoop(unsigned index);
+	unsigned currentQueueIndex() const;
+
+	Vector<std::thread*> workers;
+	Vector<TaskQueue*> queues;  // One for each worker, the last one is shared by outside threads
+
+	std::atomic<int> queuedCount;
+	std::mutex sleepMutex;
+	std::condition_variable sleepCondition;
+	bool isStopping;
+
+	// The pool and queue index of the current thread if it's a worker
+	struct WorkerContext
+	{
+		ThreadPool* pool;
+		unsigned index;
+	};
+	static WorkerContext& currentWorker()
+	{
+		static thread_local WorkerContext context = { nullptr, 0 };
+		return context;
+	}
+};
+
+class ThreadPool::TaskGroup
+{
+public:
+	explicit TaskGroup(ThreadPool& inPool = ThreadPool::instance()) :pool(inPool), pending(0) {}
+	~TaskGroup() { wait(); }
+
+	template<typename FUNC> void run(FUNC&& func)
+	{
+		++pending;
+		pool.submit(Task{ std::function<void()>(std::forward<FUNC>(func)), this });
+	}
+
+	// Run tasks of the pool until all tasks of this group are done.
+	void wait()
+	{
+		while (pending.load() != 0)
+		{
+			if (!pool.runOneTask()) std::this_thread::yield();
+		}
+	}
+
+	ThreadPool& getPool() const { return pool; }
+
+private:
+	ThreadPool& pool;
+	std::atomic<int> pending;
+
+	friend class ThreadPool;
+};
+
+inline ThreadPool::ThreadPool(unsigned threadCount) :queuedCount(0), isStopping(false)
+{
+	if (threadCount == 0) threadCount = 1;
+	for (unsigned i = 0; i < threadCount; ++i)
+	{
+		queues.push_back(new TaskQueue);
+	}
+	for (unsigned i = 0; i + 1 < threadCount; ++i)
+	{
+		workers.push_back(new std::thread([this, i]() { workerLoop(i); }));
+	}
+}
+
+inline ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		isStopping = true;
+	}
+	sleepCondition.notify_all();
+	for (auto worker : workers)
+	{
+		worker->join();
+		delete worker;
+	}
+	for (auto queue : queues)
+	{
+		delete queue;
+	}
+}
+
+inline unsigned ThreadPool::currentQueueIndex() const
+{
+	const WorkerContext& context = currentWorker();
+	return context.pool == this ? context.index : queues.size() - 1;
+}
+
+inline void ThreadPool::submit(Task&& task)
+{
+	TaskQueue* queue = queues[currentQueueIndex()];
+	{
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->tasks.push_back(std::move(task));
+	}
+	++queuedCount;
+	{
+		// Make sure a worker going to sleep see the new task
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	sleepCondition.notify_one();
+}
+
+inline bool ThreadPool::runOneTask()
+{
+	Task task;
+	bool found = false;
+
+	// Take the newest task of our own queue first, then steal the oldest one from others.
+	const unsigned ownIndex = currentQueueIndex();
+	{
+		TaskQueue* queue = queues[ownIndex];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		if (!queue->tasks.empty())
+		{
+			task = std::move(queue->tasks.back());
+			queue->tasks.pop_back();
+			found = true;
+		}
+	}
+	for (unsigned i = 1; !found && i < queues.size(); ++i)
+	{
+		TaskQueue* queue = queues[(ownIndex + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		if (!queue->tasks.empty())
+		{
+			task = std::move(queue->tasks.front());
+			queue->tasks.pop_front();
+			found = true;
+		}
+	}
+	if (!found) return false;
+
+	--queuedCount;
+	task.func();
+	--task.group->pending;
+	return true;
+}
+
+inline void ThreadPool::workerLoop(unsigned index)
+{
+	currentWorker().pool = this;
+	currentWorker().index = index;
+	while (true)
+	{
+		if (runOneTask()) continue;
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		sleepCondition.wait(lock, [this]() { return isStopping || queuedCount.load() > 0; });
+		if (isStopping) return;
+	}
+}
+
+template<typename FUNC>
+inline void ThreadPool::parallelFor(unsigned n, const FUNC& func)
+{
+	if (n <= 1 || threadCount() == 1)
+	{
+		for (unsigned i = 0; i < n; ++i) func(i);
+		return;
+	}
+
+	TaskGroup group(*this);
+	for (unsigned i = 1; i < n; ++i)
+	{
+		group.run([&func, i]() { func(i); });
+	}
+	func(0);
+	group.wait();
+}
@@ -221,15 +221,18 @@ typename Vector<T>::VectorIterator Vector<T>::insert(VectorIterator p, VectorIte
 	expand(increasedCapacity);
 	p = begin() + diff2;
 
-	VectorIterator srcIt = p;
-	VectorIterator destIt = p + diff;
-	while (srcIt != end())
+	// Move elements after p backward, start from the last one so nothing is overwritten before it's moved
+	VectorIterator srcIt = end();
+	VectorIterator destIt = end() + diff;
+	while (srcIt != p)
 	{
-		*destIt++ = *srcIt++;
+		*--destIt = *--srcIt;
 	}
 
+	// Keep the range end in a local, writing T may alias e for char
+	const VectorIterator last = e;
 	VectorIterator it = p;
-	while (b != e)
+	while (b != last)
 	{
 		*it++ = *b++;
 	}
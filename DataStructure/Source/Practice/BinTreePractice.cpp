@@ -61,7 +61,7 @@ void PFCTree::internalGeneratePFCTable(PFCTreeNodeType* node, PFCCodeType& code)
 	}
 	if(node->isLeaf())
 	{
-		PFCTable.emplace(node->getData(), code);
+		PFCTable.insert(node->getData(), code);
 	}
 	if(!code.empty()) code.pop_back();
 }
@@ -0,0 +1,284 @@
+#include "Practice\EvaluatePipeline.h"
+#include "Practice\StackPractice.h"
+
+#include "Queue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+typedef std::chrono::steady_clock PipelineClock;
+
+// Size of the input text of one chunk, the chunk is extended to the end of line.
+const unsigned PipelineChunkSize = 64 * 1024;
+// Chunks waiting in the reorder buffer for every thread
+const unsigned PipelineChunksPerThread = 4;
+
+// --------------------
+// Read only memory mapped file
+// --------------------
+
+class MappedFile
+{
+public:
+	MappedFile() :data(nullptr), size(0) {}
+	~MappedFile() { close(); }
+
+	bool open(const char* path);
+	void close();
+
+	const char* begin() const { return data; }
+	const char* end() const { return data + size; }
+
+private:
+	const char* data;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+};
+
+#ifdef _WIN32
+bool MappedFile::open(const char* path)
+{
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) return false;
+	size = static_cast<size_t>(fileSize.QuadPart);
+	if (size == 0) return true;
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) return false;
+	data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	return data != nullptr;
+}
+
+void MappedFile::close()
+{
+	if (data) UnmapViewOfFile(data);
+	if (mapping) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	data = nullptr;
+	size = 0;
+	mapping = nullptr;
+	file = INVALID_HANDLE_VALUE;
+}
+#else
+bool MappedFile::open(const char* path)
+{
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+	size = static_cast<size_t>(fileStat.st_size);
+	if (size == 0)
+	{
+		::close(fd);
+		return true;
+	}
+	void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);  // The mapping is still valid after close
+	if (p == MAP_FAILED)
+	{
+		size = 0;
+		return false;
+	}
+	madvise(p, size, MADV_SEQUENTIAL);
+	data = static_cast<const char*>(p);
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (data) munmap(const_cast<char*>(data), size);
+	data = nullptr;
+	size = 0;
+}
+#endif
+
+// --------------------
+// Chunk evaluation
+// --------------------
+
+struct PipelineChunk
+{
+	PipelineChunk(const char* b, const char* e, Vector<char>* inText, ThreadPool& pool)
+		:begin(b), end(e), text(inText), expressionCount(0), latency(0), group(pool) {}
+	~PipelineChunk() { delete text; }
+
+	const char* begin;
+	const char* end;
+	Vector<char>* text;  // Own the input if it's not from a mapped file
+
+	Vector<char> output;
+	unsigned expressionCount;
+	double latency;
+	ThreadPool::TaskGroup group;
+};
+
+void appendResult(Vector<char>& output, bool isSuccess, EvaluateResultType result)
+{
+	char buffer[32] = "error\n";
+	if (isSuccess) snprintf(buffer, sizeof(buffer), "%.9g\n", result);
+	for (const char* p = buffer; *p != '\0'; ++p) output.push_back(*p);
+}
+
+void evaluateChunk(PipelineChunk& chunk)
+{
+	// Expressions in the input are not NUL-terminated, copy each line to the scratch buffer of this thread.
+	static thread_local Vector<char> line;
+
+	const PipelineClock::time_point startTime = PipelineClock::now();
+	const char* p = chunk.begin;
+	while (p < chunk.end)
+	{
+		const char* lineEnd = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+		if (!lineEnd) lineEnd = chunk.end;
+
+		line.clear();
+		for (const char* c = p; c != lineEnd; ++c)
+		{
+			if (*c != '\r') line.push_back(*c);
+		}
+		line.push_back('\0');
+
+		EvaluateResultType result = 0;
+		bool isSuccess = tryEvaluate(line.begin(), result);
+		appendResult(chunk.output, isSuccess, result);
+		++chunk.expressionCount;
+
+		p = lineEnd + 1;
+	}
+	chunk.latency = std::chrono::duration<double>(PipelineClock::now() - startTime).count();
+}
+
+// --------------------
+// Reorder buffer, chunks are written in the order they are submitted.
+// --------------------
+
+class PipelineWriter
+{
+public:
+	PipelineWriter(std::ostream& inOut, ThreadPool& inPool)
+		:out(inOut), pool(inPool), maxChunks(inPool.threadCount() * PipelineChunksPerThread), expressionCount(0), startTime(PipelineClock::now()) {}
+
+	// Evaluate lines in [b, e) on the pool. text is deleted after the chunk is written.
+	void submit(const char* b, const char* e, Vector<char>* text = nullptr)
+	{
+		if (chunks.size() >= maxChunks) writeOldest();
+
+		PipelineChunk* chunk = new PipelineChunk(b, e, text, pool);
+		chunk->group.run([chunk]() { evaluateChunk(*chunk); });
+		chunks.push(chunk);
+	}
+
+	void finish(EvaluatePipelineStats* stats)
+	{
+		while (!chunks.empty()) writeOldest();
+		out.flush();
+		if (!stats) return;
+
+		stats->expressionCount = expressionCount;
+		stats->chunkCount = latencies.size();
+		stats->seconds = std::chrono::duration<double>(PipelineClock::now() - startTime).count();
+		stats->expressionsPerSecond = stats->seconds > 0 ? expressionCount / stats->seconds : 0;
+		stats->p99ChunkLatency = 0;
+		if (!latencies.empty())
+		{
+			auto p99 = latencies.begin() + latencies.size() * 99 / 100;
+			std::nth_element(latencies.begin(), p99, latencies.end());
+			stats->p99ChunkLatency = *p99;
+		}
+	}
+
+private:
+	void writeOldest()
+	{
+		// Wait for the oldest chunk, the waiting thread helps the pool meanwhile.
+		PipelineChunk* chunk = chunks.front();
+		chunks.pop();
+		chunk->group.wait();
+
+		out.write(chunk->output.begin(), chunk->output.size());
+		expressionCount += chunk->expressionCount;
+		latencies.push_back(chunk->latency);
+		delete chunk;
+	}
+
+	std::ostream& out;
+	ThreadPool& pool;
+	const unsigned maxChunks;
+	Queue<PipelineChunk*> chunks;
+
+	unsigned long long expressionCount;
+	Vector<double> latencies;
+	PipelineClock::time_point startTime;
+};
+
+// --------------------
+// Input
+// --------------------
+
+bool evaluateFile(const char* path, std::ostream& out, EvaluatePipelineStats* stats, ThreadPool& pool)
+{
+	MappedFile file;
+	if (!file.open(path)) return false;
+
+	PipelineWriter writer(out, pool);
+	const char* p = file.begin();
+	const char* end = file.end();
+	while (p < end)
+	{
+		// Extend the chunk to the end of line
+		const char* chunkEnd = static_cast<size_t>(end - p) > PipelineChunkSize ? p + PipelineChunkSize : end;
+		while (chunkEnd < end && *(chunkEnd - 1) != '\n') ++chunkEnd;
+		writer.submit(p, chunkEnd);
+		p = chunkEnd;
+	}
+	writer.finish(stats);
+	return true;
+}
+
+void evaluateStream(std::istream& in, std::ostream& out, EvaluatePipelineStats* stats, ThreadPool& pool)
+{
+	PipelineWriter writer(out, pool);
+	Vector<char> carry;  // Incomplete line of last read
+	while (true)
+	{
+		Vector<char>* text = new Vector<char>(carry.size() + PipelineChunkSize, '\0');
+		for (unsigned i = 0; i < carry.size(); ++i) (*text)[i] = carry[i];
+		in.read(text->begin() + carry.size(), PipelineChunkSize);
+		const unsigned length = carry.size() + static_cast<unsigned>(in.gcount());
+		const bool isEnd = !in;
+
+		// Submit the complete lines, the rest is carried to next read
+		unsigned split = length;
+		if (!isEnd)
+		{
+			while (split > 0 && (*text)[split - 1] != '\n') --split;
+		}
+		carry.clear();
+		for (unsigned i = split; i < length; ++i) carry.push_back((*text)[i]);
+
+		if (split > 0) writer.submit(text->begin(), text->begin() + split, text);
+		else delete text;
+
+		if (isEnd) break;
+	}
+	writer.finish(stats);
+}
@@ -0,0 +1,81 @@
+// Standalone benchmark of the expression pipeline, build it with EvaluatePipeline.cpp and StackPractice.cpp.
+// EvaluatePipelineBench [lines] [input file]
+// Without an input file, the lines are generated to a temp file which is removed at the end.
+// It reports expressions/sec and the p99 chunk latency of evaluateFile and evaluateStream at 1-32 threads.
+
+#include "Practice\EvaluatePipeline.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <streambuf>
+
+// Drop the results, only the evaluation is measured
+class NullBuffer : public std::streambuf
+{
+protected:
+	int overflow(int c) override { return c; }
+	std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+// Short and long expressions with some invalid ones, like a real input
+static bool generateInput(const char* path, unsigned lines)
+{
+	std::ofstream out(path, std::ios::binary);
+	if (!out) return false;
+	for (unsigned i = 0; i < lines; ++i)
+	{
+		switch (i % 8)
+		{
+		case 0: out << i << "+1\n"; break;
+		case 1: out << "(" << i % 97 << "+3)*(" << i % 13 << "-2)/4\n"; break;
+		case 2: out << "2^" << i % 10 << "-" << i % 7 << "!\n"; break;
+		case 3: out << "((1+2)*(3+4)-(5-6)*(7+8))/(" << i % 5 + 1 << ")\n"; break;
+		case 4: out << "-" << i % 1000 << ".5*-(2+" << i % 3 << ")\r\n"; break;
+		case 5: out << "1+2+3+4+5+6+7+8+9+10+11+12+13+14+15+16\n"; break;
+		case 6: out << "(" << i % 11 << "+\n"; break;  // Invalid
+		default: out << i % 100 << "/(" << i % 4 << "-" << i % 4 << ")\n"; break;  // Division by zero
+		}
+	}
+	return static_cast<bool>(out);
+}
+
+static void printStats(const char* name, unsigned threads, const EvaluatePipelineStats& stats)
+{
+	printf("%-7s %2u threads: %10.0f exp/s, %8.3f ms p99 chunk, %u chunks, %.3f s\n", name, threads,
+		stats.expressionsPerSecond, stats.p99ChunkLatency * 1000, stats.chunkCount, stats.seconds);
+}
+
+int main(int argc, char* argv[])
+{
+	const unsigned lines = argc > 1 ? static_cast<unsigned>(strtoul(argv[1], nullptr, 10)) : 2000000;
+	const bool generated = argc <= 2;
+	const char* path = generated ? "EvaluatePipelineBench.txt" : argv[2];
+	if (generated && !generateInput(path, lines))
+	{
+		printf("Can't write %s\n", path);
+		return 1;
+	}
+
+	NullBuffer nullBuffer;
+	std::ostream out(&nullBuffer);
+	const unsigned threadCounts[] = { 1, 2, 4, 8, 16, 32 };
+	for (unsigned threads : threadCounts)
+	{
+		ThreadPool pool(threads);
+		EvaluatePipelineStats stats;
+		if (!evaluateFile(path, out, &stats, pool))
+		{
+			printf("Can't open %s\n", path);
+			return 1;
+		}
+		printStats("file", threads, stats);
+
+		std::ifstream in(path, std::ios::binary);
+		evaluateStream(in, out, &stats, pool);
+		printStats("stream", threads, stats);
+	}
+
+	if (generated) remove(path);
+	return 0;
+}
@@ -0,0 +1,79 @@
+// Standalone benchmark of HashMap against the search trees and std::unordered_map.
+// HashMapBench [max keys]
+// Keys are distinct 64-bit integers in random order, the counts are 1K, 10K, ... up to max keys (10M by default,
+// 100M takes about 10 GB with the trees). It reports ns per insert and ns per successful lookup in random order.
+
+#include "HashMap.h"
+#include "AVLTree.h"
+#include "RedBlackTree.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+typedef long long Key;
+typedef std::chrono::steady_clock BenchClock;
+
+const size_t LookupCount = 4000000;
+
+static double secondsSince(BenchClock::time_point start)
+{
+	return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+// insert(key) builds the container, find(key) returns a value depending on the found key
+template<typename INSERT, typename FIND>
+static void measure(const char* name, const std::vector<Key>& keys, const std::vector<Key>& lookups, INSERT insert, FIND find)
+{
+	BenchClock::time_point start = BenchClock::now();
+	for (Key key : keys) insert(key);
+	const double insertSeconds = secondsSince(start);
+
+	unsigned long long check = 0;
+	start = BenchClock::now();
+	for (Key key : lookups) check += find(key);
+	const double findSeconds = secondsSince(start);
+
+	printf("  %-14s insert %7.1f ns, find %7.1f ns (%llu)\n", name,
+		insertSeconds * 1e9 / keys.size(), findSeconds * 1e9 / lookups.size(), check);
+}
+
+static void benchSize(size_t count, std::mt19937_64& random)
+{
+	// Multiply by an odd constant to spread the keys, they are still distinct
+	std::vector<Key> keys(count);
+	for (size_t i = 0; i < count; ++i) keys[i] = static_cast<Key>(i * 0x9E3779B97F4A7C15ull);
+	std::shuffle(keys.begin(), keys.end(), random);
+	std::vector<Key> lookups(LookupCount);
+	for (Key& key : lookups) key = keys[random() % count];
+
+	printf("%zu keys\n", count);
+	{
+		HashMap<Key, int> map;
+		measure("HashMap", keys, lookups, [&map](Key key) { map.insert(key, 1); }, [&map](Key key) { return map.find(key)->value; });
+	}
+	{
+		std::unordered_map<Key, int> map;
+		measure("unordered_map", keys, lookups, [&map](Key key) { map.emplace(key, 1); }, [&map](Key key) { return map.find(key)->second; });
+	}
+	{
+		AVLTree<Key> tree;
+		measure("AVLTree", keys, lookups, [&tree](Key key) { tree.insert(key); }, [&tree](Key key) { return tree.search(key) != nullptr; });
+	}
+	{
+		RedBlackTree<Key> tree;
+		measure("RedBlackTree", keys, lookups, [&tree](Key key) { tree.insert(key); }, [&tree](Key key) { return tree.search(key) != nullptr; });
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const size_t maxCount = argc > 1 ? static_cast<size_t>(strtoull(argv[1], nullptr, 10)) : 10000000;
+	std::mt19937_64 random(37);
+	for (size_t count = 1000; count <= maxCount; count *= 10) benchSize(count, random);
+	return 0;
+}
@@ -1,384 +1,1880 @@
 #include "Practice\StackPractice.h"
 
+#include "BinNode.h"
+#include "FixedVector.h"
+#include "ThreadPool.h"
+
+#include <atomic>
 #include <cmath>
 #include <cstring>
+#include <limits>
+#include <map>
+#include <type_traits>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BRACKET_VALIDATOR_SSE2
+#endif
+
+inline unsigned lowestBitIndex(unsigned bits)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, bits);
+	return index;
+#else
+	return __builtin_ctz(bits);
+#endif
+}
+
+// --------------------
+// Integer formatting
+// The length is known before writing, digits are written backward from the end of the number.
+// --------------------
+
+constexpr char IntegerDigits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+// Two digits of every value in [0, Base * Base), so one division write two digits.
+template<unsigned Base>
+struct DigitPairTable
+{
+	constexpr DigitPairTable() :digits()
+	{
+		for (unsigned i = 0; i < Base * Base; ++i)
+		{
+			digits[i * 2] = IntegerDigits[i / Base];
+			digits[i * 2 + 1] = IntegerDigits[i % Base];
+		}
+	}
+
+	char digits[Base * Base * 2];
+};
+constexpr DigitPairTable<10> decimalDigitPairs;
+constexpr DigitPairTable<16> hexDigitPairs;
+
+unsigned decimalLength(unsigned long long value)
+{
+	unsigned length = 1;
+	while (true)
+	{
+		if (value < 10) return length;
+		if (value < 100) return length + 1;
+		if (value < 1000) return length + 2;
+		if (value < 10000) return length + 3;
+		value /= 10000;
+		length += 4;
+	}
+}
+
+void writeDecimal(unsigned long long value, char* end)
+{
+	const char* pairs = decimalDigitPairs.digits;
+	while (value >= 100)
+	{
+		unsigned pair = static_cast<unsigned>(value % 100) * 2;
+		value /= 100;
+		*--end = pairs[pair + 1];
+		*--end = pairs[pair];
+	}
+	if (value >= 10)
+	{
+		*--end = pairs[value * 2 + 1];
+		*--end = pairs[value * 2];
+	}
+	else *--end = IntegerDigits[value];
+}
+
+void writeHex(unsigned long long value, char* end)
+{
+	// One byte is two hex digits
+	const char* pairs = hexDigitPairs.digits;
+	while (value >= 0x100)
+	{
+		unsigned pair = static_cast<unsigned>(value & 0xff) * 2;
+		value >>= 8;
+		*--end = pairs[pair + 1];
+		*--end = pairs[pair];
+	}
+	if (value >= 0x10)
+	{
+		*--end = pairs[value * 2 + 1];
+		*--end = pairs[value * 2];
+	}
+	else *--end = IntegerDigits[value];
+}
+
+// Number of digits in base 2^shift
+unsigned powerOfTwoLength(unsigned long long value, unsigned shift)
+{
+	if (value == 0) return 1;
+#ifdef _MSC_VER
+	unsigned long highestBit;
+	_BitScanReverse64(&highestBit, value);
+	unsigned bitLength = highestBit + 1;
+#else
+	unsigned bitLength = 64 - __builtin_clzll(value);
+#endif
+	return (bitLength + shift - 1) / shift;
+}
+
+void writePowerOfTwo(unsigned long long value, unsigned shift, char* end)
+{
+	const unsigned long long mask = (1ull << shift) - 1;
+	do
+	{
+		*--end = IntegerDigits[value & mask];
+		value >>= shift;
+	} while (value);
+}
+
+// Other bases need a division for every digit, the length is unknown until all digits are written.
+char* writeGeneric(unsigned long long value, unsigned base, char* end)
+{
+	do
+	{
+		*--end = IntegerDigits[value % base];
+		value /= base;
+	} while (value);
+	return end;
+}
+
+unsigned formatInteger(long long number, int base, char* buffer)
+{
+	*buffer = '\0';
+	if (base < 2 || base > MaxIntegerBase) return 0;
+
+	unsigned long long value = static_cast<unsigned long long>(number);
+	char* p = buffer;
+	if (number < 0)
+	{
+		*p++ = '-';
+		value = 0ull - value;  // Also right for the minimum long long
+	}
+
+	unsigned length;
+	if (base == 10)
+	{
+		length = decimalLength(value);
+		writeDecimal(value, p + length);
+	}
+	else if (base == 16)
+	{
+		length = powerOfTwoLength(value, 4);
+		writeHex(value, p + length);
+	}
+	else if ((base & (base - 1)) == 0)
+	{
+		unsigned shift = 0;
+		while ((1 << shift) != base) ++shift;
+		length = powerOfTwoLength(value, shift);
+		writePowerOfTwo(value, shift, p + length);
+	}
+	else
+	{
+		char digits[64];
+		char* end = digits + 64;
+		char* begin = writeGeneric(value, base, end);
+		length = static_cast<unsigned>(end - begin);
+		memcpy(p, begin, length);
+	}
+	p[length] = '\0';
+	return static_cast<unsigned>(p + length - buffer);
+}
+
+void formatIntegers(const Vector<long long>& numbers, int base, Vector<char>& text, char separator)
+{
+	if (base < 2 || base > MaxIntegerBase) return;
+
+	// Format to a block on stack, then append the whole block to text
+	const unsigned BlockSize = 4096;
+	char block[BlockSize];
+	unsigned used = 0;
+	for (auto number : numbers)
+	{
+		if (used + IntegerFormatBufferSize > BlockSize)
+		{
+			text.insert(text.end(), block, block + used);
+			used = 0;
+		}
+		used += formatInteger(number, base, block + used);
+		block[used++] = separator;
+	}
+	text.insert(text.end(), block, block + used);
+}
+
+// --------------------
+// Bracket validation
+// --------------------
+
+void BracketValidator::reset()
+{
+	fullWords.clear();
+	topWord = 0;
+	depth = 0;
+	hasError = false;
+}
+
+inline void BracketValidator::pushBracket(unsigned code)
+{
+	unsigned slot = depth % LevelsPerWord;
+	if (slot == 0 && depth != 0)
+	{
+		fullWords.push_back(topWord);
+		topWord = 0;
+	}
+	topWord |= static_cast<unsigned long long>(code) << (slot * 2);
+	++depth;
+}
+
+inline bool BracketValidator::popBracket(unsigned code)
+{
+	if (depth == 0) return false;
+
+	unsigned slot = (depth - 1) % LevelsPerWord;
+	if (((topWord >> (slot * 2)) & 3) != code) return false;
+	topWord &= ~(3ull << (slot * 2));
+	--depth;
+	if (depth % LevelsPerWord == 0 && depth != 0)
+	{
+		topWord = fullWords.back();
+		fullWords.pop_back();
+	}
+	return true;
+}
+
+inline bool BracketValidator::processBracket(char c)
+{
+	switch (c)
+	{
+	case '(': pushBracket(1); return true;
+	case '[': pushBracket(2); return true;
+	case '{': pushBracket(3); return true;
+	case ')': return popBracket(1);
+	case ']': return popBracket(2);
+	case '}': return popBracket(3);
+	default: return true;
+	}
+}
+
+#ifdef BRACKET_VALIDATOR_SSE2
+// Bit i is set if p[i] is a bracket
+inline unsigned bracketMask16(const char* p)
+{
+	__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	// '(' and ')' only differ in the lowest bit, '[' ']' become '{' '}' with 0x20 set
+	__m128i round = _mm_cmpeq_epi8(_mm_and_si128(c, _mm_set1_epi8(static_cast<char>(0xFE))), _mm_set1_epi8('('));
+	__m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+	__m128i other = _mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('{')), _mm_cmpeq_epi8(lower, _mm_set1_epi8('}')));
+	return static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(round, other)));
+}
+#endif
+
+bool BracketValidator::feed(const char* data, size_t length)
+{
+	if (hasError) return false;
+
+	const char* p = data;
+	const char* end = data + length;
+#ifdef BRACKET_VALIDATOR_SSE2
+	// Only visit the brackets of every 32 bytes
+	while (end - p >= 32)
+	{
+		unsigned mask = bracketMask16(p) | (bracketMask16(p + 16) << 16);
+		while (mask)
+		{
+			if (!processBracket(p[lowestBitIndex(mask)]))
+			{
+				hasError = true;
+				return false;
+			}
+			mask &= mask - 1;
+		}
+		p += 32;
+	}
+#endif
+	for (; p != end; ++p)
+	{
+		if (!processBracket(*p))
+		{
+			hasError = true;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool isValidExpression(const char* exp, size_t length)
+{
+	BracketValidator validator;
+	return validator.feed(exp, length) && validator.finish();
+}
+
+// --------------------
+// Evaluate an expression and get the RPN(Reverse Polish notation).
+// --------------------
+
+enum Operator:char {ADD='+',SUB='-',MUL='*',DIV='/',POW='^',FAC='!',NEG='N',L_P='(',R_P=')'};
+
+// --------------------
+// Arithmetic of the evaluate types. Every operation return false if it overflow or is invalid.
+// --------------------
+
+// Factorials that fit in the type, built at compile time.
+template<typename T, unsigned N>
+struct FactorialTable
+{
+	constexpr FactorialTable() :value()
+	{
+		value[0] = 1;
+		for (unsigned i = 1; i < N; ++i) value[i] = value[i - 1] * static_cast<T>(i);
+	}
+
+	T value[N];
+};
+constexpr FactorialTable<double, 171> realFactorial;  // 170! is the largest one fit in double
+constexpr FactorialTable<long long, 21> integerFactorial;  // 20! is the largest one fit in long long
+
+// Exponent in [-MaxSquaringExponent, MaxSquaringExponent] is calculated by squaring instead of pow()
+const int MaxSquaringExponent = 32;
+
+template<typename T>
+T powBySquaring(T base, unsigned n)
+{
+	T ret = 1;
+	while (n)
+	{
+		if (n & 1) ret *= base;
+		n >>= 1;
+		if (n) base *= base;
+	}
+	return ret;
+}
+
+template<typename T, bool IsInteger = std::is_integral<T>::value>
+struct Arithmetic
+{
+	// Floating point, overflow goes to inf so it never fails.
+
+	static bool parse(const char*& exp, T& number)
+	{
+		number = 0;
+		while (isdigit(*exp))
+		{
+			number = number * 10 + static_cast<int>(*exp - '0');
+			++exp;
+		}
+
+		if (*exp == '.')
+		{
+			++exp;
+
+			T base = static_cast<T>(0.1);
+			while (isdigit(*exp))
+			{
+				number += static_cast<int>(*exp - '0') * base;
+				++exp;
+				base /= 10;
+			}
+		}
+		return true;
+	}
+
+	static bool toSmallInteger(T number, int& n)
+	{
+		if (!(number >= -MaxSquaringExponent && number <= MaxSquaringExponent)) return false;
+		n = static_cast<int>(number);
+		return n == number;
+	}
+
+	static bool add(T a, T b, T& result) { result = a + b; return true; }
+	static bool sub(T a, T b, T& result) { result = a - b; return true; }
+	static bool mul(T a, T b, T& result) { result = a * b; return true; }
+	static bool div(T a, T b, T& result) { result = a / b; return true; }
+	static bool neg(T a, T& result) { result = -a; return true; }
+
+	static bool pow(T a, T b, T& result)
+	{
+		int n;
+		if (toSmallInteger(b, n))
+		{
+			result = powBySquaring(a, n < 0 ? -n : n);
+			if (n < 0) result = 1 / result;
+		}
+		else
+		{
+			result = std::pow(a, b);
+		}
+		return true;
+	}
+
+	static bool factorial(T a, T& result)
+	{
+		// The fraction part is dropped, NaN fails every comparison so it's checked before the table
+		if (a != a) result = a;
+		else if (a >= 171) result = std::numeric_limits<T>::infinity();
+		else if (a < 2) result = 1;
+		else result = static_cast<T>(realFactorial.value[static_cast<int>(a)]);
+		return true;
+	}
+};
+
+template<typename T>
+struct Arithmetic<T, true>
+{
+	// Signed integer, the result is exact or the calculation fails.
+
+	static bool parse(const char*& exp, T& number)
+	{
+		number = 0;
+		while (isdigit(*exp))
+		{
+			if (!mul(number, 10, number) || !add(number, static_cast<T>(*exp - '0'), number)) return false;
+			++exp;
+		}
+		return *exp != '.';  // Fraction number is not allowed
+	}
+
+	static bool toSmallInteger(T number, int& n)
+	{
+		if (number < -MaxSquaringExponent || number > MaxSquaringExponent) return false;
+		n = static_cast<int>(number);
+		return true;
+	}
+
+	static bool add(T a, T b, T& result)
+	{
+		if ((b > 0 && a > Max() - b) || (b < 0 && a < Min() - b)) return false;
+		result = a + b;
+		return true;
+	}
+
+	static bool sub(T a, T b, T& result)
+	{
+		if ((b < 0 && a > Max() + b) || (b > 0 && a < Min() + b)) return false;
+		result = a - b;
+		return true;
+	}
+
+	static bool mul(T a, T b, T& result)
+	{
+		if (a > 0)
+		{
+			if (b > 0 ? a > Max() / b : b < Min() / a) return false;
+		}
+		else if (a < 0)
+		{
+			if (b > 0 ? a < Min() / b : b < Max() / a) return false;
+		}
+		result = a * b;
+		return true;
+	}
+
+	static bool div(T a, T b, T& result)
+	{
+		if (b == 0 || (a == Min() && b == -1)) return false;
+		result = a / b;
+		return true;
+	}
+
+	static bool neg(T a, T& result)
+	{
+		if (a == Min()) return false;
+		result = -a;
+		return true;
+	}
+
+	static bool pow(T a, T b, T& result)
+	{
+		if (b < 0)
+		{
+			// Only 1 and -1 have integer result
+			if (a == 1 || (a == -1 && b % 2 == 0)) result = 1;
+			else if (a == -1) result = -1;
+			else return false;
+			return true;
+		}
+
+		// Exponentiation by squaring with overflow check
+		T ret = 1;
+		while (b)
+		{
+			if ((b & 1) && !mul(ret, a, ret)) return false;
+			b >>= 1;
+			if (b && !mul(a, a, a)) return false;
+		}
+		result = ret;
+		return true;
+	}
+
+	static bool factorial(T a, T& result)
+	{
+		if (a < 2) result = 1;
+		else if (a > 20 || integerFactorial.value[a] > Max()) return false;
+		else result = static_cast<T>(integerFactorial.value[a]);
+		return true;
+	}
+
+	static T Max() { return std::numeric_limits<T>::max(); }
+	static T Min() { return std::numeric_limits<T>::min(); }
+};
+
+const char rpnSeparateSymbol = ' ';
+
+#pragma warning( push )
+#pragma warning( disable : 4996 )
+void appEndRpn(Vector<char>& RPN, double number)
+{
+	RPN.push_back(rpnSeparateSymbol);
+
+	char buffer[64];
+	if (number == (double)(int)number)
+	{
+		sprintf(buffer, "%i\0", (int)number);
+	}
+	else
+	{
+		sprintf(buffer, "%.2f\0", number);
+	}
+	char * p = buffer;
+	while (*p != '\0')
+	{
+		RPN.push_back(*(p++));
+	}
+}
+
+void appEndRpn(Vector<char>& RPN, long long number)
+{
+	RPN.push_back(rpnSeparateSymbol);
+
+	char buffer[64];
+	sprintf(buffer, "%lld", number);
+	char * p = buffer;
+	while (*p != '\0')
+	{
+		RPN.push_back(*(p++));
+	}
+}
+#pragma warning( pop )
+
+void appEndRpn(Vector<char>& RPN, Operator op)
+{
+	RPN.push_back(rpnSeparateSymbol);
+	if (op == NEG)
+	{
+		RPN.push_back('N');
+		RPN.push_back('E');
+		RPN.push_back('G');
+	}
+	else
+	{
+		RPN.push_back(static_cast<char>(op));
+	}
+}
+
+template<typename T>
+bool readNextNumber(const char*& exp, T& number)
+{
+	return Arithmetic<T>::parse(exp, number);
+}
+
+// Operator priority and associativity, indexed by the Operator character.
+struct OperatorTable
+{
+	constexpr OperatorTable() :priority(), rightAssociative()
+	{
+		priority[L_P] = -1;  // Never calculate until meet ')'
+		priority[ADD] = priority[SUB] = 0;
+		priority[MUL] = priority[DIV] = 1;
+		priority[NEG] = 2;
+		priority[POW] = 3;
+		priority[FAC] = 4;
+
+		rightAssociative[NEG] = true;
+		rightAssociative[POW] = true;  // 2^3^2 = 2^(3^2)
+	}
+
+	signed char priority[128];
+	bool rightAssociative[128];
+};
+constexpr OperatorTable operatorTable;
+
+inline bool shouldDelayCalculation(Operator opLhs, Operator opRhs)
+{
+	// Prefix operator(NEG) never trigger calculation, so it's never the right operator here.
+	// If the right operator has higher priority, then the left calculation should be delayed.
+	const int opLPriority = operatorTable.priority[opLhs];
+	const int opRPriority = operatorTable.priority[opRhs];
+	return opLPriority < opRPriority || (opLPriority == opRPriority && operatorTable.rightAssociative[opRhs]);
+}
+
+template<typename T>
+bool doCalculate(T number1, const Operator op, T number2, T& result)
+{
+	switch (op)
+	{
+	case ADD: return Arithmetic<T>::add(number1, number2, result);
+	case SUB: return Arithmetic<T>::sub(number1, number2, result);
+	case MUL: return Arithmetic<T>::mul(number1, number2, result);
+	case DIV: return Arithmetic<T>::div(number1, number2, result);
+	case POW: return Arithmetic<T>::pow(number1, number2, result);
+	default: return false;
+	}
+}
+
+template<typename T>
+bool doCalculate(T number1, const Operator op, T& result)
+{
+	switch (op)
+	{
+	case FAC: return Arithmetic<T>::factorial(number1, result);  // factorial
+	case NEG: return Arithmetic<T>::neg(number1, result);  // Negative symbol
+	default: return false;
+	}
+}
+
+// Stacks with inline storage, evaluate() don't allocate on heap and is safe to call from many threads.
+const unsigned MaxExpressionDepth = Program::MaxStackDepth;
+typedef Stack<Operator, FixedVector<Operator, MaxExpressionDepth>> OperatorStack;
+template<typename T> using NumberStack = Stack<T, FixedVector<T, MaxExpressionDepth>>;
+
+template<typename T>
+bool doCalculateFromStack(NumberStack<T>& numberStack, const Operator op)
+{
+	// Get numbers for the operator, push the result back to numberStack
+
+	if (numberStack.empty()) return false;
+
+	T secondNumber = numberStack.top();
+	numberStack.pop();
+
+	// Check if it's unary operator
+	T resultNumber;
+	if (op == FAC || op == NEG)
+	{
+		if (!doCalculate(secondNumber, op, resultNumber)) return false;
+	}
+	else
+	{
+		if (numberStack.empty()) return false;
+		T firstNumber = numberStack.top();
+		numberStack.pop();
+
+		if (!doCalculate(firstNumber, op, secondNumber, resultNumber)) return false;
+	}
+	numberStack.push(resultNumber);
+	return true;
+}
+
+bool isVariableCharacter(char c)
+{
+	return isalnum(c) || c == '_';
+}
+
+template<typename Emitter>
+bool parseExpression(const char* exp, Emitter& emitter)
+{
+	// Scan the expression and send numbers, variables and operators to emitter in RPN order.
+	// Emitter should provide:
+	//   typedef ... NumberType;
+	//   bool emitNumber(NumberType number);
+	//   bool emitVariable(const char* name, unsigned length);
+	//   bool emitOperator(Operator op);
+	// Return false if the expression is invalid or emitter refuse the token.
+
+	OperatorStack operatorStack;
+	bool lastIsOperand = false;  // Used for check negative symbol
+	while (*exp != '\0')
+	{
+		if (isdigit(*exp))
+		{
+			if (lastIsOperand) return false;
+			typename Emitter::NumberType currentNumber;
+			if (!readNextNumber(exp, currentNumber)) return false;
+			if (!emitter.emitNumber(currentNumber)) return false;
+			lastIsOperand = true;
+			continue;
+		}
+		if (isalpha(*exp) || *exp == '_')
+		{
+			if (lastIsOperand) return false;
+			const char* name = exp;
+			while (isVariableCharacter(*exp)) ++exp;
+			if (!emitter.emitVariable(name, static_cast<unsigned>(exp - name))) return false;
+			lastIsOperand = true;
+			continue;
+		}
+
+		Operator currentOperator;
+		switch (*exp)
+		{
+		case '(':
+			if (lastIsOperand || operatorStack.size() == MaxExpressionDepth) return false;
+			operatorStack.push(L_P);
+			break;
+		case ')':
+			// Calculate the value of subexpression in ()
+			if (!lastIsOperand) return false;
+			while (!operatorStack.empty() && operatorStack.top() != L_P)
+			{
+				if (!emitter.emitOperator(operatorStack.top())) return false;
+				operatorStack.pop();
+			}
+			if (operatorStack.empty()) return false;
+			operatorStack.pop();
+			break;
+		case '-':
+		case '+':
+			if (!lastIsOperand)
+			{
+				// Positive/negative symbol, the number has not be read yet, so just push it to stack.
+				// If there are two negative symbols, just ignore them.
+				if (*exp == '-')
+				{
+					if (!operatorStack.empty() && operatorStack.top() == NEG) operatorStack.pop();
+					else if (operatorStack.size() == MaxExpressionDepth) return false;
+					else operatorStack.push(NEG);
+				}
+				break;
+			}
+			// Binary operator
+			// fall through
+		case '*':
+		case '/':
+		case '^':
+		case '!':
+			if (!lastIsOperand) return false;
+			currentOperator = Operator(*exp);
+			// Check if we should do the calculation now.
+			// Like in num1 op1 num2 op2, if op1's priority is equal or higher than op2, than we can get result of num1 op1 num2.
+			while (!operatorStack.empty() && !shouldDelayCalculation(operatorStack.top(), currentOperator))
+			{
+				if (!emitter.emitOperator(operatorStack.top())) return false;
+				operatorStack.pop();
+			}
+			if (currentOperator == FAC)
+			{
+				// Postfix operator, the operand is ready.
+				if (!emitter.emitOperator(FAC)) return false;
+			}
+			else
+			{
+				if (operatorStack.size() == MaxExpressionDepth) return false;
+				operatorStack.push(currentOperator);
+				lastIsOperand = false;
+			}
+			break;
+		case ' ':
+			break;
+		default:
+			return false;
+		}
+		++exp;
+	}
+
+	if (!lastIsOperand) return false;
+
+	while (!operatorStack.empty())
+	{
+		if (operatorStack.top() == L_P) return false;
+		if (!emitter.emitOperator(operatorStack.top())) return false;
+		operatorStack.pop();
+	}
+	return true;
+}
+
+template<typename T>
+struct EvaluateEmitter
+{
+	typedef T NumberType;
+
+	// RPN is not generated if inRPN is nullptr
+	EvaluateEmitter(Vector<char>* inRPN) :RPN(inRPN) {}
+
+	bool emitNumber(T number)
+	{
+		if (numberStack.size() == MaxExpressionDepth) return false;
+		numberStack.push(number);
+		if (RPN) appEndRpn(*RPN, number);
+		return true;
+	}
+
+	// Only literal numbers could be evaluated directly, use compile() for variables.
+	bool emitVariable(const char* /*name*/, unsigned /*length*/) { return false; }
+
+	bool emitOperator(Operator op)
+	{
+		if (RPN) appEndRpn(*RPN, op);
+		return doCalculateFromStack(numberStack, op);
+	}
+
+	NumberStack<T> numberStack;
+	Vector<char>* RPN;
+};
+
+template<typename T>
+T evaluate(const char* exp, Vector<char>& RPN)
+{
+	// Evaluate the result of an expression and convert it to RPN(Reverse Polish notation)
+
+	EvaluateEmitter<T> emitter(&RPN);
+	if (!parseExpression(exp, emitter)) return T();
+
+	if (emitter.numberStack.empty()) return T();
+	else return emitter.numberStack.top();
+}
+
+template<typename T>
+bool tryEvaluate(const char* exp, T& result)
+{
+	EvaluateEmitter<T> emitter(nullptr);
+	if (!parseExpression(exp, emitter) || emitter.numberStack.empty()) return false;
+	result = emitter.numberStack.top();
+	return true;
+}
+
+// --------------------
+// Compile an expression to bytecode, then run it repeatedly.
+// --------------------
+
+// Return the index of variable, add it if not exist. Return -1 if there are too many variables.
+int addVariable(Vector<Vector<char>>& variables, const char* name, unsigned length)
+{
+	unsigned index = 0;
+	for (; index < variables.size(); ++index)
+	{
+		const Vector<char>& v = variables[index];
+		if (v.size() == length + 1 && strncmp(v.begin(), name, length) == 0) return static_cast<int>(index);
+	}
+	if (variables.size() > Program::MaxOperand) return -1;
+	Vector<char> v;
+	for (unsigned i = 0; i < length; ++i) v.push_back(name[i]);
+	v.push_back('\0');
+	variables.push_back(v);
+	return static_cast<int>(index);
+}
+
+template<typename T>
+struct CompileEmitter
+{
+	typedef T NumberType;
+	typedef BasicProgram<T> ProgramType;
+
+	bool emitNumber(T number)
+	{
+		// Find the same bits, folded constants can be -0 or NaN
+		unsigned index = 0;
+		while (index < constants.size() && memcmp(&constants[index], &number, sizeof(T)) != 0) ++index;
+		if (index == constants.size())
+		{
+			if (constants.size() > ProgramType::MaxOperand) return false;
+			constants.push_back(number);
+		}
+		code.push_back(ProgramType::PUSH_CONST);
+		code.push_back(static_cast<unsigned char>(index));
+		return push();
+	}
+
+	bool emitVariable(const char* name, unsigned length)
+	{
+		int index = addVariable(variables, name, length);
+		return index >= 0 && emitVariableIndex(static_cast<unsigned char>(index));
+	}
+
+	bool emitVariableIndex(unsigned char index)
+	{
+		code.push_back(ProgramType::PUSH_VAR);
+		code.push_back(index);
+		return push();
+	}
+
+	bool emitStoreTemp(unsigned char index)
+	{
+		// Store the top of stack without pop
+		code.push_back(ProgramType::STORE_TEMP);
+		code.push_back(index);
+		if (index >= tempCount) tempCount = index + 1u;
+		return depth > 0;
+	}
+
+	bool emitLoadTemp(unsigned char index)
+	{
+		code.push_back(ProgramType::LOAD_TEMP);
+		code.push_back(index);
+		return push();
+	}
+
+	bool emitOperator(Operator op)
+	{
+		switch (op)
+		{
+		case ADD: code.push_back(ProgramType::ADD); break;
+		case SUB: code.push_back(ProgramType::SUB); break;
+		case MUL: code.push_back(ProgramType::MUL); break;
+		case DIV: code.push_back(ProgramType::DIV); break;
+		case POW: code.push_back(ProgramType::POW); break;
+		case FAC: code.push_back(ProgramType::FAC); return depth > 0;
+		case NEG: code.push_back(ProgramType::NEG); return depth > 0;
+		default: return false;
+		}
+		// Binary operator pop two numbers and push one
+		if (depth < 2) return false;
+		--depth;
+		return true;
+	}
+
+	bool push()
+	{
+		if (++depth > maxDepth) maxDepth = depth;
+		return maxDepth <= ProgramType::MaxStackDepth;
+	}
+
+	Vector<unsigned char> code;
+	Vector<T> constants;
+	Vector<Vector<char>> variables;
+	unsigned depth = 0;
+	unsigned maxDepth = 0;
+	unsigned tempCount = 0;
+};
+
+// --------------------
+// Expression tree and optimization.
+// The tree is rebuilt bottom-up with constant folding and simplification,
+// then common subexpressions are merged by hash-consing when lowering it to bytecode.
+// --------------------
+
+template<typename T>
+struct ExpressionToken
+{
+	enum Type :unsigned char { NUMBER, VARIABLE, OPERATOR };
+
+	Type type;
+	Operator op;
+	unsigned char variable;
+	T number;
+	int value;  // Value number assigned when lowering
+};
+
+template<typename T> using ExpressionNode = BinNode<ExpressionToken<T>>;
+
+template<typename T>
+ExpressionNode<T>* makeNumberNode(T number)
+{
+	ExpressionToken<T> token = { ExpressionToken<T>::NUMBER, ADD, 0, number, -1 };
+	return new ExpressionNode<T>(token);
+}
+
+template<typename T>
+ExpressionNode<T>* makeVariableNode(unsigned char variable)
+{
+	ExpressionToken<T> token = { ExpressionToken<T>::VARIABLE, ADD, variable, T(), -1 };
+	return new ExpressionNode<T>(token);
+}
+
+template<typename T>
+ExpressionNode<T>* makeOperatorNode(Operator op, ExpressionNode<T>* lhs, ExpressionNode<T>* rhs = nullptr)
+{
+	ExpressionToken<T> token = { ExpressionToken<T>::OPERATOR, op, 0, T(), -1 };
+	ExpressionNode<T>* node = new ExpressionNode<T>(token);
+	node->insertAsLChild(lhs);
+	if (rhs) node->insertAsRChild(rhs);
+	return node;
+}
+
+template<typename T>
+void deleteExpression(ExpressionNode<T>* node)
+{
+	// Not recursive, a chain like x+x+...+x is as deep as its number of terms
+	if (!node) return;
+	Stack<ExpressionNode<T>*> s;
+	s.push(node);
+	while (!s.empty())
+	{
+		node = s.top();
+		s.pop();
+		if (node->hasLChild()) s.push(node->getLChild());
+		if (node->hasRChild()) s.push(node->getRChild());
+		delete node;
+	}
+}
+
+// Postorder walk with an explicit stack, a chain like x+x+...+x is as deep as its number of terms.
+// Children of a node are walked only if descend(node) is true, visit(node) is called after them.
+// Return false if visit returns false, the walk stops there.
+template<typename Node, typename DESCEND, typename VISIT>
+bool walkExpression(Node* root, DESCEND descend, VISIT visit)
+{
+	Stack<Node*> s;
+	Node* last = nullptr;  // Last visited node, the top of stack is done with its children if it's the parent of last
+	s.push(root);
+	while (!s.empty())
+	{
+		Node* node = s.top();
+		if (!(last && last->getParent() == node) && descend(node))
+		{
+			if (node->hasRChild()) s.push(node->getRChild());
+			if (node->hasLChild()) s.push(node->getLChild());
+			continue;
+		}
+		s.pop();
+		if (!visit(node)) return false;
+		last = node;
+	}
+	return true;
+}
+
+template<typename T>
+ExpressionNode<T>* cloneExpression(const ExpressionNode<T>* node)
+{
+	// Copies of subtrees wait on the stack until their parent is copied
+	Stack<ExpressionNode<T>*> copies;
+	walkExpression(node, [](const ExpressionNode<T>* p) { return p->hasChild(); }, [&copies](const ExpressionNode<T>* p)
+	{
+		ExpressionNode<T>* ret = new ExpressionNode<T>(p->getData());
+		ExpressionNode<T>* rhs = nullptr;
+		if (p->hasRChild())
+		{
+			rhs = copies.top();
+			copies.pop();
+		}
+		if (p->hasLChild())
+		{
+			ret->insertAsLChild(copies.top());
+			copies.pop();
+		}
+		if (rhs) ret->insertAsRChild(rhs);
+		copies.push(ret);
+		return true;
+	});
+	return copies.top();
+}
+
+// Take the left child and delete the node
+template<typename T>
+ExpressionNode<T>* takeLChild(ExpressionNode<T>* node)
+{
+	ExpressionNode<T>* ret = node->removeLChild();
+	deleteExpression(node);
+	return ret;
+}
+
+template<typename T>
+bool isNumber(const ExpressionNode<T>* node)
+{
+	return node->getData().type == ExpressionToken<T>::NUMBER;
+}
 
-// --------------------
-// Evaluate an expression and get the RPN(Reverse Polish notation).
-// --------------------
+template<typename T>
+bool isNumber(const ExpressionNode<T>* node, T number)
+{
+	return isNumber(node) && node->getData().number == number;
+}
 
-enum Operator:char {ADD='+',SUB='-',MUL='*',DIV='/',POW='^',FAC='!',NEG='N',L_P='(',R_P=')'};
+template<typename T>
+bool isOperator(const ExpressionNode<T>* node, Operator op)
+{
+	return node->getData().type == ExpressionToken<T>::OPERATOR && node->getData().op == op;
+}
 
-EvaluateResultType strToNumber(const char* exp)
+template<typename T>
+struct TreeEmitter
 {
-	bool isNegative = false;
-	if (*exp == '-')
+	typedef T NumberType;
+
+	~TreeEmitter()
 	{
-		isNegative = true;
-		++exp;
+		// Delete the unfinished trees if parse failed
+		while (!nodes.empty())
+		{
+			deleteExpression(nodes.top());
+			nodes.pop();
+		}
 	}
 
-	EvaluateResultType number = 0;
-
-	while (isdigit(*exp))
+	bool emitNumber(T number)
 	{
-		number = number * 10 + static_cast<int>(*exp - '0');
-		++exp;
+		nodes.push(makeNumberNode(number));
+		return true;
 	}
 
-	if (*exp == '.')
+	bool emitVariable(const char* name, unsigned length)
 	{
-		++exp;
+		int index = addVariable(variables, name, length);
+		if (index < 0) return false;
+		nodes.push(makeVariableNode<T>(static_cast<unsigned char>(index)));
+		return true;
+	}
 
-		EvaluateResultType base = 0.1f;
-		while (isdigit(*exp))
+	bool emitOperator(Operator op)
+	{
+		ExpressionNode<T>* rhs = nullptr;
+		if (op != NEG && op != FAC)
 		{
-			number += static_cast<int>(*exp - '0') * base;
-			++exp;
-			base /= 10;
+			rhs = nodes.top();
+			nodes.pop();
 		}
+		ExpressionNode<T>* lhs = nodes.top();
+		nodes.pop();
+		nodes.push(makeOperatorNode(op, lhs, rhs));
+		return true;
 	}
 
-	if (isNegative) number = -number;
+	Stack<ExpressionNode<T>*> nodes;
+	Vector<Vector<char>> variables;
+};
 
-	return number;
-}
+// Exponent in [-MaxExpandedPower, MaxExpandedPower] is expanded to multiplications
+const int MaxExpandedPower = 16;
 
-const char rpnSeparateSymbol = ' ';
+template<typename T>
+ExpressionNode<T>* expandPower(const ExpressionNode<T>* base, unsigned n)
+{
+	// Exponentiation by squaring, the same subtrees will be merged when lowering.
+	if (n == 1) return cloneExpression(base);
+	ExpressionNode<T>* half = expandPower(base, n / 2);
+	ExpressionNode<T>* ret = makeOperatorNode(MUL, half, cloneExpression(half));
+	if (n & 1) ret = makeOperatorNode(MUL, ret, cloneExpression(base));
+	return ret;
+}
 
-#pragma warning( push )
-#pragma warning( disable : 4996 )
-void appEndRpn(Vector<char>& RPN, float number)
+template<typename T>
+ExpressionNode<T>* simplifyUnary(Operator op, ExpressionNode<T>* x)
 {
-	RPN.push_back(rpnSeparateSymbol);
-	
-	char buffer[64];
-	if (number == (float)(int)number)
-	{
-		sprintf(buffer, "%i\0", (int)number);
-	}
-	else
-	{
-		sprintf(buffer, "%.2f\0", number);
-	}
-	char * p = buffer;
-	while (*p != '\0')
+	T number;
+	if (isNumber(x) && doCalculate(x->getData().number, op, number))
 	{
-		RPN.push_back(*(p++));
+		deleteExpression(x);
+		return makeNumberNode(number);
 	}
+	if (op == NEG && isOperator(x, NEG)) return takeLChild(x);  // --x = x
+	return makeOperatorNode(op, x);
 }
-#pragma warning( pop )
 
-void appEndRpn(Vector<char>& RPN, Operator op)
+template<typename T>
+ExpressionNode<T>* simplifyBinary(Operator op, ExpressionNode<T>* lhs, ExpressionNode<T>* rhs)
 {
-	RPN.push_back(rpnSeparateSymbol);
-	if (op == NEG)
+	// Calculation failed like overflow is not folded, it will fail when running.
+	T number;
+	if (isNumber(lhs) && isNumber(rhs) && doCalculate(lhs->getData().number, op, rhs->getData().number, number))
 	{
-		RPN.push_back('N');
-		RPN.push_back('E');
-		RPN.push_back('G');
+		deleteExpression(lhs);
+		deleteExpression(rhs);
+		return makeNumberNode(number);
 	}
-	else
+
+	const T zero = 0, one = 1, minusOne = -1;
+	switch (op)
 	{
-		RPN.push_back(static_cast<char>(op));
+	case ADD:
+		if (isNumber(rhs, zero)) { deleteExpression(rhs); return lhs; }
+		if (isNumber(lhs, zero)) { deleteExpression(lhs); return rhs; }
+		if (isOperator(rhs, NEG)) return makeOperatorNode(SUB, lhs, takeLChild(rhs));  // x+(-y) = x-y
+		break;
+	case SUB:
+		if (isNumber(rhs, zero)) { deleteExpression(rhs); return lhs; }
+		if (isNumber(lhs, zero)) { deleteExpression(lhs); return simplifyUnary(NEG, rhs); }
+		if (isOperator(rhs, NEG)) return makeOperatorNode(ADD, lhs, takeLChild(rhs));  // x-(-y) = x+y
+		break;
+	case MUL:
+		if (isNumber(rhs, one)) { deleteExpression(rhs); return lhs; }
+		if (isNumber(lhs, one)) { deleteExpression(lhs); return rhs; }
+		if (isNumber(rhs, minusOne)) { deleteExpression(rhs); return simplifyUnary(NEG, lhs); }
+		if (isNumber(lhs, minusOne)) { deleteExpression(lhs); return simplifyUnary(NEG, rhs); }
+		break;
+	case DIV:
+		if (isNumber(rhs, one)) { deleteExpression(rhs); return lhs; }
+		break;
+	case POW:
+		if (isNumber(rhs, one)) { deleteExpression(rhs); return lhs; }
+		if (isNumber(rhs, zero)) { deleteExpression(lhs); deleteExpression(rhs); return makeNumberNode(one); }
+		if (isNumber(rhs))
+		{
+			// Strength reduction for small integer exponent, x^3 = x*x*x, x^-2 = 1/(x*x)
+			// Integer division don't work like this, so only positive exponent is expanded for integer.
+			int n;
+			if (Arithmetic<T>::toSmallInteger(rhs->getData().number, n) && n >= -MaxExpandedPower && n <= MaxExpandedPower
+				&& (n > 0 || !std::is_integral<T>::value))
+			{
+				ExpressionNode<T>* ret = expandPower(lhs, n > 0 ? n : -n);
+				if (n < 0) ret = makeOperatorNode(DIV, makeNumberNode(one), ret);
+				deleteExpression(lhs);
+				deleteExpression(rhs);
+				return ret;
+			}
+		}
+		break;
+	default:
+		break;
 	}
+	return makeOperatorNode(op, lhs, rhs);
 }
 
-bool readNextNumber(const char*& exp, EvaluateResultType& number)
+template<typename T>
+ExpressionNode<T>* optimizeExpression(const ExpressionNode<T>* node)
 {
-	number = strToNumber(exp);
-
-	if (*exp == '-') ++exp;
-	while (isdigit(*exp) || *exp == '.')
+	// Optimized operands wait on the stack until their operator is visited
+	Stack<ExpressionNode<T>*> results;
+	walkExpression(node, [](const ExpressionNode<T>* p) { return p->getData().type == ExpressionToken<T>::OPERATOR; }, [&results](const ExpressionNode<T>* p)
 	{
-		++exp;
-	}
+		const ExpressionToken<T>& token = p->getData();
+		if (token.type != ExpressionToken<T>::OPERATOR)
+		{
+			results.push(new ExpressionNode<T>(token));
+			return true;
+		}
 
-	return true;
+		ExpressionNode<T>* rhs = nullptr;
+		if (p->hasRChild())
+		{
+			rhs = results.top();
+			results.pop();
+		}
+		ExpressionNode<T>* lhs = results.top();
+		results.pop();
+		results.push(rhs ? simplifyBinary(token.op, lhs, rhs) : simplifyUnary(token.op, lhs));
+		return true;
+	});
+	return results.top();
 }
 
-bool shouldDelayCalculation(Operator opLhs, Operator opRhs)
+template<typename T>
+struct CodeGenerator
 {
-	if (opLhs == L_P) return true;
+	// Structure of a value, same key means same value
+	struct ValueKey
+	{
+		typename ExpressionToken<T>::Type type;
+		Operator op;
+		unsigned char variable;
+		T number;
+		int lhs, rhs;
+
+		bool operator<(const ValueKey& rhsKey) const
+		{
+			if (type != rhsKey.type) return type < rhsKey.type;
+			if (op != rhsKey.op) return op < rhsKey.op;
+			if (variable != rhsKey.variable) return variable < rhsKey.variable;
+			// Compare the bits of number, NaN is not equal to other numbers and -0 is not 0
+			const int numberOrder = memcmp(&number, &rhsKey.number, sizeof(T));
+			if (numberOrder != 0) return numberOrder < 0;
+			if (lhs != rhsKey.lhs) return lhs < rhsKey.lhs;
+			return rhs < rhsKey.rhs;
+		}
+	};
 
-	// Special case like 2^-2
-	if (opLhs == POW && opRhs == NEG) return true;
+	// Hash-consing, give every distinct subtree a value number and count how many times it's used.
+	void numberValues(ExpressionNode<T>* root)
+	{
+		walkExpression(root, [](ExpressionNode<T>* p) { return p->hasChild(); }, [this](ExpressionNode<T>* node)
+		{
+			// Children have their value numbers already
+			ExpressionToken<T>& token = node->getData();
+			ValueKey key = { token.type, token.op, token.variable, token.number, -1, -1 };
+			if (node->hasLChild()) key.lhs = node->getLChild()->getData().value;
+			if (node->hasRChild()) key.rhs = node->getRChild()->getData().value;
 
-	// Store the operator priority
-	static Vector<Vector<Operator>> operatorPriority;
-	static bool isInitialized = false;
+			auto it = valueTable.find(key);
+			if (it != valueTable.end())
+			{
+				token.value = it->second;
+			}
+			else
+			{
+				token.value = static_cast<int>(useCount.size());
+				valueTable.emplace(key, token.value);
+				useCount.push_back(0);
+				tempOfValue.push_back(-1);
+				// Children are used once by each distinct value
+				if (key.lhs >= 0) ++useCount[key.lhs];
+				if (key.rhs >= 0) ++useCount[key.rhs];
+			}
+			return true;
+		});
+	}
 
-	if(!isInitialized)
+	bool generate(const ExpressionNode<T>* root, CompileEmitter<T>& emitter)
 	{
-		Vector<Operator> priority4;
-		priority4.push_back(FAC);
-		Vector<Operator> priority3;
-		priority3.push_back(POW);
-		Vector<Operator> priority2;
-		priority2.push_back(NEG);
-		Vector<Operator> priority1;
-		priority1.push_back(MUL); priority1.push_back(DIV);
-		Vector<Operator> priority0;
-		priority0.push_back(ADD); priority0.push_back(SUB);
+		// A value kept in a temp is loaded, its subtree is not generated again
+		auto descend = [this](const ExpressionNode<T>* p)
+		{
+			return p->getData().type == ExpressionToken<T>::OPERATOR && tempOfValue[p->getData().value] < 0;
+		};
+		return walkExpression(root, descend, [this, &emitter](const ExpressionNode<T>* node)
+		{
+			const ExpressionToken<T>& token = node->getData();
+			switch (token.type)
+			{
+			case ExpressionToken<T>::NUMBER: return emitter.emitNumber(token.number);
+			case ExpressionToken<T>::VARIABLE: return emitter.emitVariableIndex(token.variable);
+			default: break;
+			}
+
+			if (tempOfValue[token.value] >= 0) return emitter.emitLoadTemp(static_cast<unsigned char>(tempOfValue[token.value]));
 
-		operatorPriority.push_back(priority0);
-		operatorPriority.push_back(priority1);
-		operatorPriority.push_back(priority2);
-		operatorPriority.push_back(priority3);
-		operatorPriority.push_back(priority4);
+			if (!emitter.emitOperator(token.op)) return false;
 
-		isInitialized = true;
+			if (useCount[token.value] > 1)
+			{
+				// Used again later, keep it in a temp
+				if (tempCount > BasicProgram<T>::MaxOperand) return false;
+				tempOfValue[token.value] = static_cast<int>(tempCount);
+				return emitter.emitStoreTemp(static_cast<unsigned char>(tempCount++));
+			}
+			return true;
+		});
 	}
 
-	// Get priority of two given operators
-	int opLPriority = 0, opRPriority = 0;
+	std::map<ValueKey, int> valueTable;
+	Vector<int> useCount;
+	Vector<int> tempOfValue;
+	unsigned tempCount = 0;
+};
 
-	for (int i = 0; i < operatorPriority.size(); ++i)
+template<typename T>
+BasicProgram<T> compile(const char* exp, bool optimize)
+{
+	BasicProgram<T> program;
+	CompileEmitter<T> emitter;
+	if (!optimize)
 	{
-		auto p = operatorPriority[i];
-		if (Algorithm::find(p.begin(), p.end(), opLhs) != p.end())
-		{
-			opLPriority = i;
-			break;
-		}
+		if (!parseExpression(exp, emitter)) return program;
 	}
-	for (int i = 0; i < operatorPriority.size(); ++i)
+	else
 	{
-		auto p = operatorPriority[i];
-		if (Algorithm::find(p.begin(), p.end(), opRhs) != p.end())
-		{
-			opRPriority = i;
-			break;
-		}
+		TreeEmitter<T> treeEmitter;
+		if (!parseExpression(exp, treeEmitter)) return program;
+
+		ExpressionNode<T>* root = optimizeExpression(treeEmitter.nodes.top());
+		CodeGenerator<T> generator;
+		generator.numberValues(root);
+		const bool generated = generator.generate(root, emitter);
+		deleteExpression(root);
+		if (!generated) return program;
+		emitter.variables = treeEmitter.variables;
 	}
 
-	// If the right operator has higher priority, then the left calculation should be delayed.
-	return opLPriority < opRPriority;
+	program.code = emitter.code;
+	program.constants = emitter.constants;
+	program.variables = emitter.variables;
+	program.maxStackDepth = emitter.maxDepth;
+	program.tempCount = emitter.tempCount;
+	return program;
 }
 
-EvaluateResultType doCalculate(EvaluateResultType number1, const Operator op, EvaluateResultType number2)
+template<typename T>
+int BasicProgram<T>::variableIndex(const char* name) const
 {
-	switch (op)
+	for (unsigned i = 0; i < variables.size(); ++i)
 	{
-	case ADD: return number1 + number2;
-	case SUB: return number1 - number2;
-	case MUL: return number1 * number2;
-	case DIV: return number1 / number2;
-	case POW: return pow(number1,number2);
+		if (strcmp(variables[i].begin(), name) == 0) return static_cast<int>(i);
 	}
-	return 0.f;
+	return -1;
 }
 
-EvaluateResultType doCalculate(EvaluateResultType number1, const Operator op)
+template<typename T>
+bool BasicProgram<T>::run(const T* vars, T& result) const
 {
-	int result = 0;
-	switch (op)
+	// Stack machine, the depth is checked in compile so no bound check here.
+	// The checks of Arithmetic are removed by compiler for floating point.
+	typedef Arithmetic<T> A;
+	T stack[MaxStackDepth];
+	T temps[MaxOperand + 1];
+	unsigned top = 0;
+
+	const unsigned char* pc = code.begin();
+	const unsigned char* end = code.end();
+	const T* constantPool = constants.begin();
+	while (pc != end)
 	{
-	case FAC:  // factorial
-		result = static_cast<int>(number1);
-		for (int i = result - 1; i > 0; --i)
+		switch (*pc++)
 		{
-			result *= i;
+		case PUSH_CONST: stack[top++] = constantPool[*pc++]; break;
+		case PUSH_VAR: stack[top++] = vars[*pc++]; break;
+		case LOAD_TEMP: stack[top++] = temps[*pc++]; break;
+		case STORE_TEMP: temps[*pc++] = stack[top - 1]; break;
+		case ADD: --top; if (!A::add(stack[top - 1], stack[top], stack[top - 1])) return false; break;
+		case SUB: --top; if (!A::sub(stack[top - 1], stack[top], stack[top - 1])) return false; break;
+		case MUL: --top; if (!A::mul(stack[top - 1], stack[top], stack[top - 1])) return false; break;
+		case DIV: --top; if (!A::div(stack[top - 1], stack[top], stack[top - 1])) return false; break;
+		case POW: --top; if (!A::pow(stack[top - 1], stack[top], stack[top - 1])) return false; break;
+		case FAC: if (!A::factorial(stack[top - 1], stack[top - 1])) return false; break;
+		case NEG: if (!A::neg(stack[top - 1], stack[top - 1])) return false; break;
 		}
-		return result > 0 ? result : 1;
-	case NEG:  // Negative symbol
-		return -number1;
 	}
-	return 0.f;
-}
 
-void doCalculateFromStack(Stack<EvaluateResultType>& numberStack, Stack<Operator>& operatorStack)
-{
-	// Get numbers and operator, push the result back to numberStack
-
-	if (numberStack.empty() && operatorStack.empty()) return;
+	if (!top) return false;
+	result = stack[top - 1];
+	return true;
+}
 
-	Operator currentOpeator = operatorStack.top();
-	operatorStack.pop();
+// --------------------
+// Batch evaluation over columns. Each stack slot of the interpreter is a whole block of rows.
+// --------------------
 
-	EvaluateResultType secondNumber = numberStack.top();
-	numberStack.pop();
+template<typename T>
+struct BatchSlot
+{
+	const T* data;  // nullptr if the slot is a scalar
+	T scalar;
+};
 
-	// Check if it's unary operator
-	if (currentOpeator == FAC || currentOpeator == NEG)
+template<typename T, typename OP>
+bool batchCalculate(BatchSlot<T>& lhs, const BatchSlot<T>& rhs, T* out, unsigned count, OP op)
+{
+	// Simple loops on contiguous data, so compiler can vectorize them.
+	const T* a = lhs.data;
+	const T* b = rhs.data;
+	bool isSuccess = true;
+	if (a && b)
+	{
+		for (unsigned i = 0; i < count; ++i) isSuccess &= op(a[i], b[i], out[i]);
+	}
+	else if (a)
 	{
-		EvaluateResultType resultNumber = doCalculate(secondNumber, currentOpeator);
-		numberStack.push(resultNumber);
+		const T s = rhs.scalar;
+		for (unsigned i = 0; i < count; ++i) isSuccess &= op(a[i], s, out[i]);
+	}
+	else if (b)
+	{
+		const T s = lhs.scalar;
+		for (unsigned i = 0; i < count; ++i) isSuccess &= op(s, b[i], out[i]);
 	}
 	else
 	{
-		EvaluateResultType firstNumber = numberStack.top();
-		numberStack.pop();
-
-		EvaluateResultType resultNumber = doCalculate(firstNumber, currentOpeator, secondNumber);
-		numberStack.push(resultNumber);
+		return op(lhs.scalar, rhs.scalar, lhs.scalar);
 	}
+	lhs.data = out;
+	return isSuccess;
 }
 
-EvaluateResultType evaluate(const char* exp, Vector<char>& RPN)
+template<typename T>
+void batchPowInteger(const T* base, int exponent, T* out, unsigned count)
 {
-	// Evaluate the result of an expression and convert it to RPN(Reverse Polish notation)
-
-	if (*exp == '\0') return 0.f;
-	// Create two stacks to store numbers and operators
-	Stack<Operator> operatorStack;
-	Stack<EvaluateResultType> numberStack;
-	
-	// Handle if the first character is positive/negative symbol
-	if (*exp == '-')
+	// Exponentiation by squaring, the loop on bits is outside so the loops on elements can be vectorized.
+	T square[BasicProgram<T>::BatchBlockSize];
+	unsigned n = exponent < 0 ? -exponent : exponent;
+	for (unsigned i = 0; i < count; ++i)
 	{
-		operatorStack.push(NEG);
-		++exp;
+		square[i] = base[i];
+		out[i] = 1;
 	}
-	if (*exp == '+')
+	while (n)
 	{
-		++exp;
+		if (n & 1)
+		{
+			for (unsigned i = 0; i < count; ++i) out[i] *= square[i];
+		}
+		n >>= 1;
+		if (n)
+		{
+			for (unsigned i = 0; i < count; ++i) square[i] *= square[i];
+		}
 	}
-	Operator currentOperator;  // Used for check negative symbol
-	while (true)
+	if (exponent < 0)
 	{
-		if (*exp == '\0') break;  // Reach end of the expression
-		if (isdigit(*exp))
+		for (unsigned i = 0; i < count; ++i) out[i] = 1 / out[i];
+	}
+}
+
+template<typename T>
+bool BasicProgram<T>::runBlock(const T* const* columns, unsigned rowBegin, unsigned count, T* output, T* scratch) const
+{
+	typedef Arithmetic<T> A;
+	BatchSlot<T> stack[MaxStackDepth];
+	BatchSlot<T> temps[MaxOperand + 1];
+	unsigned top = 0;
+	bool isSuccess = true;
+
+	const unsigned char* pc = code.begin();
+	const unsigned char* end = code.end();
+	while (pc != end)
+	{
+		const unsigned char op = *pc++;
+		if (op == PUSH_CONST)
 		{
-			// Push number to stack
-			EvaluateResultType currentNumber;
-			if(!readNextNumber(exp, currentNumber)) return 0.f;
-			numberStack.push(currentNumber);
-			appEndRpn(RPN, currentNumber);
+			stack[top].data = nullptr;
+			stack[top].scalar = constants[*pc++];
+			++top;
+			continue;
 		}
-		else
+		if (op == PUSH_VAR)
+		{
+			// Read from the column directly, no copy
+			stack[top].data = columns[*pc++] + rowBegin;
+			++top;
+			continue;
+		}
+		if (op == LOAD_TEMP)
+		{
+			stack[top++] = temps[*pc++];
+			continue;
+		}
+		if (op == STORE_TEMP)
 		{
-			switch (*exp)
+			// The block on stack will be overwritten later, copy it to the temp block.
+			// Scalar and column don't need copy.
+			const unsigned index = *pc++;
+			const BatchSlot<T>& v = stack[top - 1];
+			BatchSlot<T>& temp = temps[index];
+			temp = v;
+			if (v.data >= scratch && v.data < scratch + maxStackDepth * BatchBlockSize)
 			{
-			case '(':
-				operatorStack.push(L_P);
-				++exp;
-				break;
-			case ')':
-				// Calculate the value of subexpression in ()
-				while (operatorStack.top() != L_P)
-				{
-					appEndRpn(RPN, operatorStack.top());
-					doCalculateFromStack(numberStack, operatorStack);
-				}
-				operatorStack.pop();
-				++exp;
-				break;
-			case '-':
-			case '+':
-			case '*':
-			case '/':
-			case '^':
-			case '!':
-				// Check for negative symbol
-				if (*exp == '-' && !isdigit(*(exp - 1)) && *(exp - 1) != ')' && *(exp - 1) != '!')
-				{
-					currentOperator = NEG;
-					// If there are two negative symbols, just ignore them, since the number has not be in stack yet, we can't do calculation right now.
-					if (operatorStack.top() == NEG)
-					{
-						operatorStack.pop();
-						++exp;
-						break;
-					}
-				}
-				else 
-					currentOperator = Operator(*exp);
-				// Check if we should do the calculation now.
-				// Like in num1 op1 num2 op2, if op1's priority is equal or higher than op2, than we can get result of num1 op1 num2.
-				while (!operatorStack.empty() && !shouldDelayCalculation(operatorStack.top(), currentOperator))
-				{
+				T* buffer = scratch + (maxStackDepth + index) * BatchBlockSize;
+				for (unsigned i = 0; i < count; ++i) buffer[i] = v.data[i];
+				temp.data = buffer;
+			}
+			continue;
+		}
 
-					appEndRpn(RPN, operatorStack.top());
-					doCalculateFromStack(numberStack, operatorStack);
-				}
-				operatorStack.push(currentOperator);
-				++exp;
-				break;
-			case ' ':
-				++exp;
-				break;
-			default:
-				return 0.f;
-				break;
+		if (op == NEG || op == FAC)
+		{
+			BatchSlot<T>& v = stack[top - 1];
+			if (!v.data)
+			{
+				isSuccess &= op == NEG ? A::neg(v.scalar, v.scalar) : A::factorial(v.scalar, v.scalar);
+				continue;
+			}
+			T* out = pc == end ? output : scratch + (top - 1) * BatchBlockSize;
+			if (op == NEG)
+			{
+				for (unsigned i = 0; i < count; ++i) isSuccess &= A::neg(v.data[i], out[i]);
+			}
+			else
+			{
+				for (unsigned i = 0; i < count; ++i) isSuccess &= A::factorial(v.data[i], out[i]);
+			}
+			v.data = out;
+			continue;
+		}
+
+		--top;
+		BatchSlot<T>& lhs = stack[top - 1];
+		const BatchSlot<T>& rhs = stack[top];
+		T* out = pc == end ? output : scratch + (top - 1) * BatchBlockSize;  // Last operator write to output directly
+		int n;
+		switch (op)
+		{
+		case ADD: isSuccess &= batchCalculate(lhs, rhs, out, count, [](T a, T b, T& r) { return A::add(a, b, r); }); break;
+		case SUB: isSuccess &= batchCalculate(lhs, rhs, out, count, [](T a, T b, T& r) { return A::sub(a, b, r); }); break;
+		case MUL: isSuccess &= batchCalculate(lhs, rhs, out, count, [](T a, T b, T& r) { return A::mul(a, b, r); }); break;
+		case DIV: isSuccess &= batchCalculate(lhs, rhs, out, count, [](T a, T b, T& r) { return A::div(a, b, r); }); break;
+		case POW:
+			if (!std::is_integral<T>::value && lhs.data && !rhs.data && A::toSmallInteger(rhs.scalar, n))
+			{
+				// Integer exponent, like x^2
+				batchPowInteger(lhs.data, n, out, count);
+				lhs.data = out;
+			}
+			else
+			{
+				isSuccess &= batchCalculate(lhs, rhs, out, count, [](T a, T b, T& r) { return A::pow(a, b, r); });
 			}
+			break;
 		}
 	}
 
-	// Now calculate the final result
-	while (!operatorStack.empty())
+	const BatchSlot<T>& result = stack[0];
+	if (result.data == output) return isSuccess;
+	if (result.data)
+	{
+		for (unsigned i = 0; i < count; ++i) output[i] = result.data[i];
+	}
+	else
+	{
+		for (unsigned i = 0; i < count; ++i) output[i] = result.scalar;
+	}
+	return isSuccess;
+}
+
+template<typename T>
+bool BasicProgram<T>::runBatch(const T* const* columns, unsigned rowCount, T* output, bool parallel) const
+{
+	if (!valid())
 	{
-		appEndRpn(RPN, operatorStack.top());
-		doCalculateFromStack(numberStack, operatorStack);
+		for (unsigned i = 0; i < rowCount; ++i) output[i] = T();
+		return false;
 	}
+	if (rowCount == 0) return true;
+
+	const unsigned blockCount = (rowCount + BatchBlockSize - 1) / BatchBlockSize;
+	const unsigned scratchSize = (maxStackDepth + tempCount) * BatchBlockSize;
 
-	if (numberStack.empty()) return 0.f;
-	else return numberStack.top();
+	// Each task handle a range of blocks with its own scratch, a few tasks per thread for load balance.
+	ThreadPool& pool = ThreadPool::instance();
+	unsigned taskCount = parallel ? pool.threadCount() * 4 : 1;
+	if (taskCount > blockCount) taskCount = blockCount;
+
+	std::atomic<bool> isSuccess(true);
+	pool.parallelFor(taskCount, [&](unsigned task)
+	{
+		Vector<T> scratch(scratchSize, T());
+		const unsigned blockBegin = static_cast<unsigned>(static_cast<unsigned long long>(blockCount) * task / taskCount);
+		const unsigned blockEnd = static_cast<unsigned>(static_cast<unsigned long long>(blockCount) * (task + 1) / taskCount);
+		for (unsigned block = blockBegin; block < blockEnd; ++block)
+		{
+			const unsigned rowBegin = block * BatchBlockSize;
+			const unsigned count = rowCount - rowBegin < BatchBlockSize ? rowCount - rowBegin : BatchBlockSize;
+			if (!runBlock(columns, rowBegin, count, output + rowBegin, scratch.begin())) isSuccess = false;
+		}
+	});
+	return isSuccess;
 }
 
+// Supported evaluate types
+template float evaluate<float>(const char* exp, Vector<char>& RPN);
+template double evaluate<double>(const char* exp, Vector<char>& RPN);
+template long long evaluate<long long>(const char* exp, Vector<char>& RPN);
+template bool tryEvaluate<float>(const char* exp, float& result);
+template bool tryEvaluate<double>(const char* exp, double& result);
+template bool tryEvaluate<long long>(const char* exp, long long& result);
+template class BasicProgram<float>;
+template class BasicProgram<double>;
+template class BasicProgram<long long>;
+template BasicProgram<float> compile<float>(const char* exp, bool optimize);
+template BasicProgram<double> compile<double>(const char* exp, bool optimize);
+template BasicProgram<long long> compile<long long>(const char* exp, bool optimize);
+
 // --------------------
 // N Queen Problem
 // --------------------
 
-bool isPositonAvaiable(const Position2D& pos, const List<Position2D>& placedQueen)
+// Columns and both diagonals under attack are kept as bitmasks, bit i is column i of the current row.
+// Diagonals are shifted by one column when moving to the next row.
+const int MaxNQueen = 31;
+
+unsigned long long countNQueenFrom(unsigned fullMask, unsigned columns, unsigned leftDiagonals, unsigned rightDiagonals)
+{
+	if (columns == fullMask) return 1;
+
+	unsigned long long count = 0;
+	unsigned available = fullMask & ~(columns | leftDiagonals | rightDiagonals);
+	while (available)
+	{
+		unsigned bit = available & (0u - available);  // Lowest free column
+		available ^= bit;
+		count += countNQueenFrom(fullMask, columns | bit, (leftDiagonals | bit) << 1, (rightDiagonals | bit) >> 1);
+	}
+	return count;
+}
+
+// Call onSolution(queenColumns) for every solution, queenColumns[row] is the column of queen in that row.
+template<typename FUNC>
+void searchNQueenFrom(unsigned fullMask, unsigned columns, unsigned leftDiagonals, unsigned rightDiagonals,
+	int row, unsigned char* queenColumns, FUNC& onSolution)
+{
+	if (columns == fullMask)
+	{
+		onSolution(static_cast<const unsigned char*>(queenColumns));
+		return;
+	}
+
+	unsigned available = fullMask & ~(columns | leftDiagonals | rightDiagonals);
+	while (available)
+	{
+		unsigned bit = available & (0u - available);
+		available ^= bit;
+		queenColumns[row] = static_cast<unsigned char>(lowestBitIndex(bit));
+		searchNQueenFrom(fullMask, columns | bit, (leftDiagonals | bit) << 1, (rightDiagonals | bit) >> 1,
+			row + 1, queenColumns, onSolution);
+	}
+}
+
+inline unsigned nQueenFullMask(int N)
 {
-	if (placedQueen.empty()) return true;
+	return (1u << N) - 1;
+}
+
+unsigned long long countNQueen(int N)
+{
+	if (N <= 0 || N > MaxNQueen) return 0;
+
+	// The mirror of a solution is also a solution, so only search the left half of first row.
+	const unsigned fullMask = nQueenFullMask(N);
+	unsigned long long count = 0;
+	for (int column = 0; column < N / 2; ++column)
+	{
+		unsigned bit = 1u << column;
+		count += countNQueenFrom(fullMask, bit, bit << 1, bit >> 1);
+	}
+	count *= 2;
+	if (N % 2 == 1)
+	{
+		unsigned bit = 1u << (N / 2);
+		count += countNQueenFrom(fullMask, bit, bit << 1, bit >> 1);
+	}
+	return count;
+}
+
+void placeNQueen(int N, List<List<Position2D>>& solutions)
+{
+	if (N <= 0 || N > MaxNQueen) return;
 
-	for (auto existPosition : placedQueen)
+	// Solutions are found in lexicographic order. Mirroring reverses the order,
+	// so the mirrored solutions are added backward after the searched ones.
+	List<List<Position2D>> mirroredSolutions;
+	bool isMirrored = true;
+	auto onSolution = [&](const unsigned char* queenColumns)
 	{
-		if (pos.x == existPosition.x ||
-			pos.y == existPosition.y ||
-			pos.x - existPosition.x == pos.y - existPosition.y ||
-			pos.x - existPosition.x == existPosition.y - pos.y)
+		List<Position2D> solution, mirroredSolution;
+		for (int row = 0; row < N; ++row)
 		{
-			return false;
+			solution.push_back(Position2D{ row, queenColumns[row] });
+			if (isMirrored) mirroredSolution.push_back(Position2D{ row, N - 1 - queenColumns[row] });
 		}
+		solutions.push_back(solution);
+		if (isMirrored) mirroredSolutions.push_back(mirroredSolution);
+	};
+
+	const unsigned fullMask = nQueenFullMask(N);
+	unsigned char queenColumns[MaxNQueen];
+	for (int column = 0; column < (N + 1) / 2; ++column)
+	{
+		// The middle column of odd N is its own mirror
+		isMirrored = column < N / 2;
+		unsigned bit = 1u << column;
+		queenColumns[0] = static_cast<unsigned char>(column);
+		searchNQueenFrom(fullMask, bit, bit << 1, bit >> 1, 1, queenColumns, onSolution);
 	}
 
-	return true;
+	while (!mirroredSolutions.empty())
+	{
+		solutions.push_back(mirroredSolutions.back());
+		mirroredSolutions.pop_back();
+	}
 }
 
-void placeNQueen(int N, List<List<Position2D>>& solutions)
+// --------------------
+// Parallel N Queen
+// The first rows are placed in advance, every partial placement is searched as an independent task.
+// --------------------
+
+struct NQueenSubproblem
 {
-	List<Position2D> solution;
-	Position2D currentSearchPosition;
-	currentSearchPosition.x = 0, currentSearchPosition.y = 0;
-	
-	while (true)
+	unsigned columns, leftDiagonals, rightDiagonals;
+	unsigned char queenColumns[MaxNQueen];
+	bool isMirrored;  // The first queen is in the left half, its mirrored solutions should be added too
+};
+
+void splitNQueenFrom(int N, unsigned fullMask, NQueenSubproblem current, int row, int splitDepth, Vector<NQueenSubproblem>& subproblems)
+{
+	if (row == splitDepth)
+	{
+		current.isMirrored = current.queenColumns[0] < N / 2;
+		subproblems.push_back(current);
+		return;
+	}
+
+	unsigned available = fullMask & ~(current.columns | current.leftDiagonals | current.rightDiagonals);
+	if (row == 0) available &= nQueenFullMask((N + 1) / 2);
+	while (available)
+	{
+		unsigned bit = available & (0u - available);
+		available ^= bit;
+
+		NQueenSubproblem next = current;
+		next.queenColumns[row] = static_cast<unsigned char>(lowestBitIndex(bit));
+		next.columns |= bit;
+		next.leftDiagonals = (next.leftDiagonals | bit) << 1;
+		next.rightDiagonals = (next.rightDiagonals | bit) >> 1;
+		splitNQueenFrom(N, fullMask, next, row + 1, splitDepth, subproblems);
+	}
+}
+
+// Subproblems are in lexicographic order of the placed queens
+int splitNQueen(int N, Vector<NQueenSubproblem>& subproblems)
+{
+	// Three rows give N^3 / 2 tasks roughly, enough for stealing to balance the work
+	const int splitDepth = N < 3 ? N : (N < 12 ? 2 : 3);
+	NQueenSubproblem first = NQueenSubproblem();
+	splitNQueenFrom(N, nQueenFullMask(N), first, 0, splitDepth, subproblems);
+	return splitDepth;
+}
+
+unsigned long long countNQueenParallel(int N, ThreadPool& pool)
+{
+	if (N <= 0 || N > MaxNQueen) return 0;
+
+	Vector<NQueenSubproblem> subproblems;
+	splitNQueen(N, subproblems);
+	const unsigned fullMask = nQueenFullMask(N);
+
+	Vector<unsigned long long> counts(subproblems.size(), 0);
+	pool.parallelFor(subproblems.size(), [&](unsigned i)
+	{
+		const NQueenSubproblem& task = subproblems[i];
+		counts[i] = countNQueenFrom(fullMask, task.columns, task.leftDiagonals, task.rightDiagonals);
+	});
+
+	unsigned long long count = 0;
+	for (unsigned i = 0; i < subproblems.size(); ++i)
 	{
-		bool findResultSuccess = false;
+		count += subproblems[i].isMirrored ? counts[i] * 2 : counts[i];
+	}
+	return count;
+}
+
+void forEachNQueenSolution(int N, const NQueenSolutionCallback& onSolution, ThreadPool& pool)
+{
+	if (N <= 0 || N > MaxNQueen) return;
+
+	Vector<NQueenSubproblem> subproblems;
+	const int splitDepth = splitNQueen(N, subproblems);
+	const unsigned fullMask = nQueenFullMask(N);
 
-		for (; currentSearchPosition.y < N; ++currentSearchPosition.y)
+	pool.parallelFor(subproblems.size(), [&](unsigned i)
+	{
+		NQueenSubproblem task = subproblems[i];
+		unsigned char mirroredColumns[MaxNQueen];
+		auto onTaskSolution = [&](const unsigned char* queenColumns)
 		{
-			if (isPositonAvaiable(currentSearchPosition, solution))
-			{
-				findResultSuccess = true;
-				break;
-			}
-		}
+			onSolution(queenColumns);
+			if (!task.isMirrored) return;
+			for (int row = 0; row < N; ++row) mirroredColumns[row] = static_cast<unsigned char>(N - 1 - queenColumns[row]);
+			onSolution(static_cast<const unsigned char*>(mirroredColumns));
+		};
+		searchNQueenFrom(fullMask, task.columns, task.leftDiagonals, task.rightDiagonals, splitDepth, task.queenColumns, onTaskSolution);
+	});
+}
+
+void placeNQueenParallel(int N, Vector<unsigned char>& solutionRows, ThreadPool& pool)
+{
+	if (N <= 0 || N > MaxNQueen) return;
+
+	Vector<NQueenSubproblem> subproblems;
+	const int splitDepth = splitNQueen(N, subproblems);
+	const unsigned fullMask = nQueenFullMask(N);
+
+	// Every task write to its own buffer, then they are joined in order.
+	Vector<Vector<unsigned char>> taskRows(subproblems.size(), Vector<unsigned char>());
+	pool.parallelFor(subproblems.size(), [&](unsigned i)
+	{
+		NQueenSubproblem task = subproblems[i];
+		Vector<unsigned char>& rows = taskRows[i];
+		auto onTaskSolution = [&](const unsigned char* queenColumns)
+		{
+			for (int row = 0; row < N; ++row) rows.push_back(queenColumns[row]);
+		};
+		searchNQueenFrom(fullMask, task.columns, task.leftDiagonals, task.rightDiagonals, splitDepth, task.queenColumns, onTaskSolution);
+	});
 
-		if (findResultSuccess)
+	// Same order as placeNQueen, the mirrored solutions are added backward at last.
+	for (unsigned i = 0; i < taskRows.size(); ++i)
+	{
+		for (auto column : taskRows[i]) solutionRows.push_back(column);
+	}
+	for (unsigned i = taskRows.size(); i-- > 0;)
+	{
+		if (!subproblems[i].isMirrored) continue;
+		const Vector<unsigned char>& rows = taskRows[i];
+		for (unsigned solution = rows.size() / N; solution-- > 0;)
 		{
-			solution.push_back(currentSearchPosition);
-			++currentSearchPosition.x;
-			currentSearchPosition.y = 0;
-			if (currentSearchPosition.x >= N)
+			for (int row = 0; row < N; ++row)
 			{
-				// Find a solution successful
-				solutions.push_back(solution);
-				
-				currentSearchPosition = solution.back();
-				solution.pop_back();
-				++currentSearchPosition.y;
+				solutionRows.push_back(static_cast<unsigned char>(N - 1 - rows[solution * N + row]));
 			}
 		}
-		else
-		{
-			if (solution.empty()) return; // Fail to find a solution
-			currentSearchPosition = solution.back();
-			solution.pop_back();
-			++currentSearchPosition.y;
-		}
 	}
 }
 
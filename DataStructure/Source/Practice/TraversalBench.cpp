@@ -0,0 +1,85 @@
+// Standalone benchmark of the inorder traversal versions on a plain and a threaded AVL tree.
+// TraversalBench [nodes]
+// Trees of nodes (2M by default, try 10M) are built in random and in sequential order, the keys are summed
+// with every version. A random order scatters the nodes in memory, a sequential one lays them out in order.
+
+#include "BinNode.h"
+
+#include <ostream>
+
+// Same as int, but its nodes keep the link to the inorder successor
+struct ThreadedInt
+{
+	int value;
+
+	bool operator==(const ThreadedInt& rhs) const { return value == rhs.value; }
+	bool operator!=(const ThreadedInt& rhs) const { return value != rhs.value; }
+	bool operator<(const ThreadedInt& rhs) const { return value < rhs.value; }
+	bool operator>(const ThreadedInt& rhs) const { return value > rhs.value; }
+	bool operator<=(const ThreadedInt& rhs) const { return value <= rhs.value; }
+	bool operator>=(const ThreadedInt& rhs) const { return value >= rhs.value; }
+};
+template<> struct UseThreadedBinNode<ThreadedInt> : std::true_type {};
+
+// Used by BinTree::printTree
+std::ostream& operator<<(std::ostream& os, const ThreadedInt& key) { return os << key.value; }
+
+#include "AVLTree.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+typedef std::chrono::steady_clock BenchClock;
+
+static long long valueOf(int key) { return key; }
+static long long valueOf(const ThreadedInt& key) { return key.value; }
+
+template<typename T, typename WALK>
+static void measure(const char* name, const AVLTree<T>& tree, WALK walk)
+{
+	long long sum = 0;
+	const BenchClock::time_point start = BenchClock::now();
+	walk([&sum](const T& key) { sum += valueOf(key); });
+	const double seconds = std::chrono::duration<double>(BenchClock::now() - start).count();
+	printf("    %-12s %6.1f ns/node (%lld)\n", name, seconds * 1e9 / tree.size(), sum);
+}
+
+template<typename T>
+static void benchTree(const char* name, const std::vector<int>& keys)
+{
+	AVLTree<T> tree;
+	for (int key : keys) tree.insert(T{ key });
+	BinNode<T>* root = tree.root();
+
+	printf("  %s\n", name);
+	measure("ITERATION_1", tree, [root](auto func) { root->template traversalInorder<ITERATION_1>(func); });
+	measure("ITERATION_2", tree, [root](auto func) { root->template traversalInorder<ITERATION_2>(func); });
+	measure("MORRIS", tree, [root](auto func) { root->template traversalInorder<MORRIS>(func); });
+	measure("succ()", tree, [root](auto func)
+	{
+		BinNode<T>* node = root;
+		while (node->hasLChild()) node = node->getLChild();
+		for (; node; node = node->succ()) func(node->getData());
+	});
+}
+
+int main(int argc, char* argv[])
+{
+	const int count = argc > 1 ? atoi(argv[1]) : 2000000;
+	std::vector<int> keys(count);
+	for (int i = 0; i < count; ++i) keys[i] = i;
+
+	printf("%d nodes, sequential insert order\n", count);
+	benchTree<int>("plain", keys);
+	benchTree<ThreadedInt>("threaded", keys);
+
+	std::shuffle(keys.begin(), keys.end(), std::mt19937(43));
+	printf("%d nodes, random insert order\n", count);
+	benchTree<int>("plain", keys);
+	benchTree<ThreadedInt>("threaded", keys);
+	return 0;
+}
@@ -0,0 +1,98 @@
+// Standalone benchmark of the traversal versions chosen at compile time, with a tiny callback summing int keys.
+// TraversalVersionBench [nodes] [rounds] [version of the runtime switch, 0 is RECURSION]
+// An AVL tree of nodes (200K by default) is built in random order and walked rounds times (20 by default).
+// "runtime switch" is the old form kept here for comparison: the version is checked on every node
+// and the callback is copied into every recursive call.
+
+#include "AVLTree.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+typedef std::chrono::steady_clock BenchClock;
+
+struct SumFunctor
+{
+	long long sum = 0;
+	void operator()(int key) { sum += key; }
+};
+
+template<typename FUNC>
+static void runtimeInorder(BinNode<int>* node, FUNC func, TraversalImplementVersion version)
+{
+	switch (version)
+	{
+	case RECURSION:
+		if (!node) return;
+		runtimeInorder(node->getLChild(), func, version);
+		func(node->getData());
+		runtimeInorder(node->getRChild(), func, version);
+		break;
+	default:
+		node->traversalInorder<ITERATION_1>(func);
+		break;
+	}
+}
+
+template<typename WALK>
+static void measure(const char* name, int size, int rounds, WALK walk)
+{
+	long long sum = 0;
+	const BenchClock::time_point start = BenchClock::now();
+	for (int i = 0; i < rounds; ++i) sum += walk();
+	const double seconds = std::chrono::duration<double>(BenchClock::now() - start).count();
+	printf("  %-24s %6.2f ns/node (%lld)\n", name, seconds * 1e9 / rounds / size, sum);
+}
+
+// Sum with a lambda and with a functor, the functor keeps the sum after traversal
+template<TraversalImplementVersion Version>
+static void measureVersion(const char* name, AVLTree<int>& tree, int rounds)
+{
+	char label[32];
+	snprintf(label, sizeof(label), "%s lambda", name);
+	measure(label, tree.size(), rounds, [&tree]()
+	{
+		long long sum = 0;
+		tree.traversalInorder<Version>([&sum](int key) { sum += key; });
+		return sum;
+	});
+	snprintf(label, sizeof(label), "%s functor", name);
+	measure(label, tree.size(), rounds, [&tree]()
+	{
+		SumFunctor func;
+		tree.traversalInorder<Version>(func);
+		return func.sum;
+	});
+}
+
+int main(int argc, char* argv[])
+{
+	const int count = argc > 1 ? atoi(argv[1]) : 200000;
+	const int rounds = argc > 2 ? atoi(argv[2]) : 20;
+	std::vector<int> keys(count);
+	for (int i = 0; i < count; ++i) keys[i] = i;
+	std::shuffle(keys.begin(), keys.end(), std::mt19937(45));
+
+	AVLTree<int> tree;
+	for (int key : keys) tree.insert(key);
+
+	printf("%d nodes, inorder sum\n", tree.size());
+	measureVersion<RECURSION>("RECURSION", tree, rounds);
+	measureVersion<ITERATION_1>("ITERATION_1", tree, rounds);
+	measureVersion<ITERATION_2>("ITERATION_2", tree, rounds);
+	measureVersion<MORRIS>("MORRIS", tree, rounds);
+
+	// Read the version at run time so the switch isn't folded
+	const TraversalImplementVersion version = argc > 3 ? static_cast<TraversalImplementVersion>(atoi(argv[3])) : RECURSION;
+	measure("runtime switch", tree.size(), rounds, [&tree, version]()
+	{
+		long long sum = 0;
+		runtimeInorder(tree.root(), [&sum](int key) { sum += key; }, version);
+		return sum;
+	});
+	return 0;
+}